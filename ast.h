@@ -1,497 +1,478 @@
 #pragma once
 #include <cstdint>
-#include <map>
 #include <memory>
+#include <span>
+#include <utility>
 #define AST_H
 #include "lexer.h"
+#include "src/Arena.h"
+#include "src/TokenStream.h"
+#include "src/Symbols.h"
+#include "src/TopLevels.h"
+
+/*
+* Nodes are allocated in the Arena of a piece of their Program and refer to
+* each other by raw pointer; child lists are arena arrays. Nothing in a node
+* owns memory, so the whole tree is released at once with the pieces. Token
+* literals and names are views of the program text.
+*
+* Print appends a node's text to the caller's buffer in a single pass over
+* the subtree; String() is Print into a fresh string.
+*
+* Every node is tagged with its kind, so passes over the tree switch on Kind
+* and static_cast instead of trying dynamic_casts in turn.
+*/
+
+/*
+* kinds of nodes, shared by the tree and the FlatAst
+*/
+enum class NodeKind : uint8_t {
+	ExpressionStatement,
+	Let,
+	Return,
+	Block,
+	Function,
+	Identifier,
+	Integer,
+	Float,
+	Boolean,
+	String,
+	Prefix,
+	Infix,
+	Index,
+	If,
+	While,
+	Call,
+	Array,
+	Hash,
+	Program, // tree only
+};
 
 struct Node {
-	Node() = default;
+	Node(NodeKind kind) : Kind(kind) {}
+	const NodeKind Kind;
 	virtual string TokenLiteral() = 0;
-	virtual string String() = 0;
+	virtual void Print(string& out) = 0;
+	/*
+	* prints `child`, or a placeholder where a syntax error left none
+	*/
+	static void PrintChild(Node* child, string& out) {
+		if (child != nullptr) {
+			child->Print(out);
+		}
+		else {
+			out += "<error>";
+		}
+	}
+	string String() {
+		string out;
+		Print(out);
+		return out;
+	}
 	~Node() = default;
 };
 
 struct Statement : Node {
-	Statement() = default;
+	Statement(NodeKind kind) : Node(kind) {}
 	virtual void statementNode() = 0;
 	~Statement() = default;
 };
 
 struct Expression : Node {
-	Expression() = default;
+	Expression(NodeKind kind) : Node(kind) {}
 	virtual void expressionNode() = 0;
 	~Expression() = default;
 };
 
+/*
+* the tokens a part of a program was parsed from and the arena owning the
+* nodes built from them. A parsed program is a single piece, programs made
+* by Parser::Reparse share the pieces they reuse with earlier versions
+*/
+struct ProgramPiece {
+	ProgramPiece(std::shared_ptr<const TokenStream> tokens) : tokens(std::move(tokens)) {}
+	std::shared_ptr<const TokenStream> tokens; // the text the nodes view
+	Arena arena;
+};
+
 struct Program : Node {
-	Program() { Statements = vector<shared_ptr<Statement>>(); }
-	vector<std::shared_ptr<Statement>> Statements;
+	Program(std::shared_ptr<const TokenStream> tokens) : Node(NodeKind::Program) {
+		pieces.push_back(std::make_shared<ProgramPiece>(std::move(tokens)));
+	}
+	// the statements, with how they were parsed (see Parser::Reparse)
+	TopLevelList TopLevels;
+	uint32_t Length = 0; // of the program text
+	vector<std::shared_ptr<ProgramPiece>> pieces; // own every node of the tree, the first one is parsed into
+	vector<uint32_t> pieceUnits; // TopLevels from each piece
+
+	Arena& arena() { return pieces.front()->arena; }
 
 	string TokenLiteral() {
-		if (Statements.size() > 0) {
-			return Statements[0]->TokenLiteral();
-		}
-		else {
-			return "";
+		for (auto unit : TopLevels) {
+			if (unit.statement != nullptr) {
+				return unit.statement->TokenLiteral();
+			}
 		}
+		return "";
 	}
 
-	string String() {
-		string out = "";
-
-		for (auto& s : Statements) {
-			out += s->String();
+	void Print(string& out) {
+		for (auto unit : TopLevels) {
+			if (unit.statement != nullptr) {
+				unit.statement->Print(out);
+			}
 		}
+	}
 
-		return out;
+	/*
+	* streams the program text to `out` (an llvm::raw_ostream or a
+	* std::ostream: anything with write(data, size)) one top-level statement
+	* at a time through a reused buffer, so a dump never holds the whole text
+	*/
+	template <typename Stream>
+	void Write(Stream& out) {
+		string buffer;
+		for (auto unit : TopLevels) {
+			if (unit.statement != nullptr) {
+				buffer.clear();
+				unit.statement->Print(buffer);
+				out.write(buffer.data(), buffer.size());
+			}
+		}
 	}
-	~Program() {}
 };
 
 struct Identifier : Expression {
-	Identifier(Token token, string value) : Token(token), Value(value) {}
-	Identifier(Token token, string value, TokenType type) : Token(token), Value(value), type(type) {}
+	Identifier(Token token, Symbol name) : Expression(NodeKind::Identifier), Token(token), Name(name) {}
+	Identifier(Token token, Symbol name, TokenType type) : Expression(NodeKind::Identifier), Token(token), Name(name), type(type) {}
 
 	Token Token; // the token.IDENT token
-	string Value;
-	TokenType type;  // the type of the identifier
+	Symbol Name; // the interned name, see SymbolTable
+	TokenType type = ILLEGAL;  // the type of the identifier
 	void expressionNode() {}
 
-	string TokenLiteral() { return Token.Literal; }
+	string TokenLiteral() { return string(Token.Literal); }
 
-	string String() { return Value; }
-	~Identifier() {}
+	void Print(string& out) { out += Token.Literal; }
 };
 struct LetStatement : Statement {
-	LetStatement(Token token) : Token(token) {}
+	LetStatement(Token token) : Statement(NodeKind::Let), Token(token) {}
 	Token Token; // the token.LET token
-	std::unique_ptr<Identifier> Name;
-	std::unique_ptr<Expression>Value;
+	Identifier* Name = nullptr;
+	Expression* Value = nullptr;
 
 	void statementNode() {}
 
-	string TokenLiteral() { return Token.Literal; }
+	string TokenLiteral() { return string(Token.Literal); }
 
-	string String() {
-		string out = "";
-
-		out += TokenLiteral() + " ";
-		out += Name->String();
+	void Print(string& out) {
+		out += Token.Literal;
+		out += " ";
+		PrintChild(Name, out);
 		out += " = ";
 
 		if (Value != nullptr) {
-			out += Value->String();
+			Value->Print(out);
 		}
 		out += ";";
-
-		return out;
 	}
-	~LetStatement() {}
 };
 
 
 struct ReturnStatement : Statement {
-	ReturnStatement(Token token, std::unique_ptr<Expression>returnValue = nullptr) : Token(token) {
-		ReturnValue = std::move(returnValue);
-	}
+	ReturnStatement(Token token, Expression* returnValue = nullptr) : Statement(NodeKind::Return), Token(token), ReturnValue(returnValue) {}
 	Token Token; // the 'return' token
-	std::unique_ptr<Expression>ReturnValue;
+	Expression* ReturnValue;
 	void statementNode() {}
 
-	string TokenLiteral() { return Token.Literal; }
+	string TokenLiteral() { return string(Token.Literal); }
 
-	string String() {
-		string out = "";
-
-		out += TokenLiteral() + " ";
+	void Print(string& out) {
+		out += Token.Literal;
+		out += " ";
 
 		if (ReturnValue != nullptr) {
-			out += ReturnValue->String();
+			ReturnValue->Print(out);
 		}
 
 		out += ";";
-
-		return out;
-	}
-	~ReturnStatement()
-	{
-
 	}
 };
 
 struct ExpressionStatement : Statement {
-	ExpressionStatement(Token token) : Token(token), Expression(nullptr) {}
+	ExpressionStatement(Token token) : Statement(NodeKind::ExpressionStatement), Token(token), Expression(nullptr) {}
 	Token Token; // the first token of the expression
-	std::unique_ptr<Expression> Expression;
+	Expression* Expression;
 
 	void statementNode() {}
 
-	string TokenLiteral() { return Token.Literal; }
+	string TokenLiteral() { return string(Token.Literal); }
 
-	string String() {
+	void Print(string& out) {
 		if (Expression != nullptr) {
-			return Expression->String();
+			Expression->Print(out);
 		}
-		return "";
-	}
-	~ExpressionStatement()
-	{
-
 	}
 };
 
 struct IntegerLiteral : Expression {
-	IntegerLiteral(Token token) : Token(token) {}
-	IntegerLiteral(Token token, int64_t value) : Token(token), Value(value) {}
+	IntegerLiteral(Token token) : Expression(NodeKind::Integer), Token(token) {}
+	IntegerLiteral(Token token, int64_t value) : Expression(NodeKind::Integer), Token(token), Value(value) {}
 	Token Token;
 	int64_t Value;
 
 	void expressionNode() {}
 
-	string TokenLiteral() { return Token.Literal; }
-
-	string String() { return Token.Literal; }
-	~IntegerLiteral()
-	{
+	string TokenLiteral() { return string(Token.Literal); }
 
-	}
+	void Print(string& out) { out += Token.Literal; }
 };
 
 struct FloatLiteral : Expression {
-	FloatLiteral(Token token) : Token(token) {}
-	FloatLiteral(Token token, int64_t value) : Token(token), Value(value) {}
+	FloatLiteral(Token token) : Expression(NodeKind::Float), Token(token) {}
+	FloatLiteral(Token token, int64_t value) : Expression(NodeKind::Float), Token(token), Value(value) {}
 	Token Token;
 	double Value;
 
 	void expressionNode() {}
 
-	string TokenLiteral() { return Token.Literal; }
-
-	string String() { return Token.Literal; }
-	~FloatLiteral()
-	{
+	string TokenLiteral() { return string(Token.Literal); }
 
-	}
+	void Print(string& out) { out += Token.Literal; }
 };
 
 struct PrefixExpression : Expression {
-	PrefixExpression(Token token, string operator_)
-		: Token(token), Operator(operator_) {}
+	PrefixExpression(Token token, string_view operator_)
+		: Expression(NodeKind::Prefix), Token(token), Operator(operator_) {}
 	Token Token;
-	string Operator;
-	std::unique_ptr<Expression> Right;
+	string_view Operator;
+	Expression* Right = nullptr;
 
 	void expressionNode() {}
 
-	string TokenLiteral() { return Token.Literal; }
-
-	string String() {
-		string out = "";
+	string TokenLiteral() { return string(Token.Literal); }
 
+	void Print(string& out) {
 		out += "(";
 		out += Operator;
-		out += Right->String();
+		PrintChild(Right, out);
 		out += ")";
-
-		return out;
-	}
-	~PrefixExpression()
-	{
-
 	}
 };
 
 struct InfixExpression : Expression {
-	InfixExpression(Token token, string operator_, std::unique_ptr<Expression>left, std::unique_ptr<Expression>right)
-		: Token(token), Left(std::move(left)), Operator(operator_), Right(std::move(right)) {}
+	InfixExpression(Token token, string_view operator_, Expression* left, Expression* right)
+		: Expression(NodeKind::Infix), Token(token), Left(left), Operator(operator_), Right(right) {}
 	Token Token; // the operator such as + , * ,....
-	std::unique_ptr<Expression> Left;
-	string Operator;
-	std::unique_ptr<Expression>Right;
+	Expression* Left;
+	string_view Operator;
+	Expression* Right;
 
 	void expressionNode() {}
 
-	string TokenLiteral() { return Token.Literal; }
-
-	string String() {
-		string out = "";
+	string TokenLiteral() { return string(Token.Literal); }
 
+	void Print(string& out) {
 		out += "(";
-		out += Left->String();
-		out += " " + Operator + " ";
-		out += Right->String();
+		PrintChild(Left, out);
+		out += " ";
+		out += Operator;
+		out += " ";
+		PrintChild(Right, out);
 		out += ")";
-
-		return out;
-	}
-	~InfixExpression()
-	{
-
 	}
 };
 
 struct IndexExpression : Expression {
-	IndexExpression(Token token, std::unique_ptr<Expression>left = nullptr) : Token(token), Left(std::move(left)) {}
+	IndexExpression(Token token, Expression* left = nullptr) : Expression(NodeKind::Index), Token(token), Left(left) {}
 	Token Token; // The [ token
-	std::unique_ptr<Expression>Left;
-	std::unique_ptr<Expression>Index;
+	Expression* Left;
+	Expression* Index = nullptr;
 
 	void expressionNode() {}
 
-	string TokenLiteral() { return Token.Literal; }
+	string TokenLiteral() { return string(Token.Literal); }
 
-	string String() {
-		string out = "";
+	void Print(string& out) {
 		out += "(";
-		out += Left->String();
+		PrintChild(Left, out);
 		out += "[";
-		out += Index->String();
+		PrintChild(Index, out);
 		out += "])";
-		return out;
-	}
-	~IndexExpression()
-	{
-
 	}
 };
 
 struct Boolean : Expression {
-	Boolean(Token token, bool value) : Token(token), Value(value) {}
+	Boolean(Token token, bool value) : Expression(NodeKind::Boolean), Token(token), Value(value) {}
 	Token Token;
 	bool Value;
 
 	void expressionNode() {}
 
-	string TokenLiteral() { return Token.Literal; }
-
-	string String() { return Token.Literal; }
-	~Boolean()
-	{
+	string TokenLiteral() { return string(Token.Literal); }
 
-	}
+	void Print(string& out) { out += Token.Literal; }
 };
 
 struct BlockStatement : Statement {
-	BlockStatement(Token token) : Token(token) {}
+	BlockStatement(Token token) : Statement(NodeKind::Block), Token(token) {}
 	Token Token; // the '{' token
-	vector<std::unique_ptr<Statement>> Statements;
+	std::span<Statement*> Statements;
 
 	void statementNode() {}
 
-	string TokenLiteral() { return Token.Literal; }
+	string TokenLiteral() { return string(Token.Literal); }
 
-	string String() {
-		string out = "";
+	void Print(string& out) {
 		for (auto& s : Statements) {
-			out += s->String();
+			if (s != nullptr) {
+				s->Print(out);
+			}
 		}
-		return out;
 	}
-	~BlockStatement() {}
 };
 
 struct IfExpression : Expression {
-	IfExpression(Token token) : Token(token) {}
+	IfExpression(Token token) : Expression(NodeKind::If), Token(token) {}
 	Token Token;
-	std::unique_ptr< Expression >Condition;
-	std::unique_ptr<BlockStatement> Consequence;
-	std::unique_ptr<BlockStatement> Alternative;
+	Expression* Condition = nullptr;
+	BlockStatement* Consequence = nullptr;
+	BlockStatement* Alternative = nullptr;
 
 	void expressionNode() {}
 
-	string TokenLiteral() { return Token.Literal; }
-
-	string String() {
-		string out = "";
+	string TokenLiteral() { return string(Token.Literal); }
 
+	void Print(string& out) {
 		out += "if";
-		out += Condition->String();
+		PrintChild(Condition, out);
 		out += " ";
-		out += Consequence->String();
+		PrintChild(Consequence, out);
 
 		if (Alternative != nullptr) {
 			out += "else ";
-			out += Alternative->String();
+			Alternative->Print(out);
 		}
-
-		return out;
-	}
-	~IfExpression()
-	{
-
 	}
 };
 
 struct WhileExpression : Expression {
-	WhileExpression(Token token) : Token(token) {}
+	WhileExpression(Token token) : Expression(NodeKind::While), Token(token) {}
 	Token Token; // the while token
-	std::unique_ptr<Expression> Condition;
-	std::unique_ptr<BlockStatement> Body;
+	Expression* Condition = nullptr;
+	BlockStatement* Body = nullptr;
 
 	void expressionNode() {}
 
-	string TokenLiteral() { return Token.Literal; }
+	string TokenLiteral() { return string(Token.Literal); }
 
-	string String() {
-		string out = "";
-		out += TokenLiteral();
+	void Print(string& out) {
+		out += Token.Literal;
 		out += "(";
-		out += Condition->String();
+		PrintChild(Condition, out);
 		out += ") ";
-		out += Body->String();
-		return out;
-	}
-	~WhileExpression()
-	{
-
+		PrintChild(Body, out);
 	}
 };
 // i32 ident() {
 //   // something
 // }
 struct FunctionLiteral : Statement {
-	FunctionLiteral(Token token) : Type(token) {}
+	FunctionLiteral(Token token) : Statement(NodeKind::Function), Type(token) {}
 	Token Type; // the 'type' token function type
 	Token ident; // function name;
-	vector<std::unique_ptr<Identifier>> Parameters;
-	std::unique_ptr<BlockStatement> Body;
+	Symbol Name = SymbolTable::None;
+	std::span<Identifier*> Parameters;
+	BlockStatement* Body = nullptr;
 
 	void statementNode() {};
 
-	string TokenLiteral() { return Type.Literal; }
-
-	string String() {
-		string out = "";
-
-		vector<string> params;
-		for (auto& p : Parameters) {
-			params.push_back(p->String());
-		}
+	string TokenLiteral() { return string(Type.Literal); }
 
-		out += TokenLiteral();
+	void Print(string& out) {
+		out += Type.Literal;
 		out += "(";
-		for (auto& p : params) {
-			out += p;
+		for (auto& p : Parameters) {
+			PrintChild(p, out);
 			out += ", ";
 		}
 		out += ") ";
-		out += "-> " + ident.Literal;
-		out += Body->String();
-		return out;
-	}
-	~FunctionLiteral()
-	{
-
+		out += "-> ";
+		out += ident.Literal;
+		PrintChild(Body, out);
 	}
 };
 
 struct CallExpression : Expression {
-	CallExpression(Token token, std::unique_ptr<Expression> function = nullptr)
-		: Token(token) {
-
-		Function = std::move(function);
-	}
+	CallExpression(Token token, Expression* function = nullptr)
+		: Expression(NodeKind::Call), Token(token), Function(function) {}
 	Token Token;          // The '(' token
-	std::unique_ptr<Expression> Function; // Identifier or FunctionLiteral
-	vector<std::unique_ptr<Expression>> Arguments;
+	Expression* Function; // Identifier or FunctionLiteral
+	std::span<Expression*> Arguments;
 
 	void expressionNode() {}
 
-	string TokenLiteral() { return Token.Literal; }
+	string TokenLiteral() { return string(Token.Literal); }
 
-	string String() {
-		string out = "";
-		vector<string> args;
-		for (auto& a : Arguments) {
-			args.push_back(a->String());
-		}
-		out += Function->String();
+	void Print(string& out) {
+		PrintChild(Function, out);
 		out += "(";
-		for (auto& arg : args) {
-			out += arg;
+		for (auto& a : Arguments) {
+			PrintChild(a, out);
 			out += ", ";
 		}
 		out += ")";
-		return out;
-	}
-	~CallExpression()
-	{
-
 	}
 };
 
 struct StringLiteral : Expression {
-	StringLiteral(Token token, string value) : Token(token), Value(value) {}
+	StringLiteral(Token token, string_view value) : Expression(NodeKind::String), Token(token), Value(value) {}
 	Token Token;
-	string Value;
+	string_view Value;
 
 	void expressionNode() {}
 
-	string TokenLiteral() { return Token.Literal; }
-
-	string String() { return Token.Literal; }
-	~StringLiteral()
-	{
+	string TokenLiteral() { return string(Token.Literal); }
 
-	}
+	void Print(string& out) { out += Token.Literal; }
 };
 
 struct ArrayLiteral : Expression {
-	ArrayLiteral(Token token) : Token(token) {}
+	ArrayLiteral(Token token) : Expression(NodeKind::Array), Token(token) {}
 	Token Token; // the '[' token
-	vector<std::unique_ptr<Expression>> Elements;
+	std::span<Expression*> Elements;
 
 	void expressionNode() {}
 
-	string TokenLiteral() { return Token.Literal; }
+	string TokenLiteral() { return string(Token.Literal); }
 
-	string String() {
-		string out = "";
-		vector<string> elements;
-		for (auto& el : Elements) {
-			elements.push_back(el->String());
-		}
+	void Print(string& out) {
 		out += "[";
-		for (auto& el : elements) {
-			out += el;
+		for (auto& el : Elements) {
+			PrintChild(el, out);
 			out += ", ";
 		}
 		out += "]";
-		return out;
-	}
-	~ArrayLiteral()
-	{
-
 	}
 };
 
 struct HashLiteral : Expression {
-	HashLiteral(Token token) : Token(token) {}
+	HashLiteral(Token token) : Expression(NodeKind::Hash), Token(token) {}
 	Token Token; //? the '{' token
-	map<std::unique_ptr<Expression>, std::unique_ptr<Expression>> Pairs;
+	std::span<std::pair<Expression*, Expression*>> Pairs; // in source order
 
 	void expressionNode() {}
 
-	string TokenLiteral() { return Token.Literal; }
-
-	string String() {
-		string out = "";
-		vector<string> pairs;
-		for (auto& pair : Pairs) {
-			pairs.push_back(pair.first->String() + ":" + pair.second->String());
-		}
+	string TokenLiteral() { return string(Token.Literal); }
 
+	void Print(string& out) {
 		out += "{";
-		for (auto& p : pairs) {
-			out += p;
+		for (auto& pair : Pairs) {
+			PrintChild(pair.first, out);
+			out += ":";
+			PrintChild(pair.second, out);
 			out += ", ";
 		}
 		out += "}";
-		return out;
-	}
-	~HashLiteral()
-	{
-
 	}
 };
@@ -0,0 +1,117 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+
+#include "../src/TokenStream.h"
+
+/*
+* lex_bench: how TokenStream(input, threads) scales with its threads.
+*
+*   lex_bench generate <file> <MiB>   writes a program of about MiB
+*   lex_bench <file> [threads] [runs] lexes it on 1 to threads threads
+*
+* threads defaults to one per core and runs to 3; each row is the best
+* of its runs. Every stream is checked token for token against the one
+* thread stream, and a difference fails the benchmark.
+*/
+
+/*
+* a source of `megabytes` MiB of functions, loops, calls and string
+* literals (some with spaces and operators in them, so that a cut has to
+* find its way out of a string)
+*/
+static std::string generate(size_t megabytes) {
+	std::mt19937 random(7);
+	std::string out;
+	out.reserve(megabytes << 20);
+	for (size_t n = 0; out.size() < megabytes << 20; n++) {
+		auto a = random() % 1000, b = random() % 1000;
+		switch (random() % 4)
+		{
+		case 0:
+			out += "i32 f" + std::to_string(n) + "(i32 a, i64 b){\n  let s = a * " + std::to_string(a) +
+				" + b / 3;\n  if (s < " + std::to_string(b) + ") { return s - 1; } else { return s % 7; }\n}\n";
+			break;
+		case 1:
+			out += "let v" + std::to_string(n) + " = [" + std::to_string(a) + ", " + std::to_string(b) +
+				", 3.25];\nwhile (v" + std::to_string(n) + "[0] > 0) { mut v" + std::to_string(n) + " = 0; }\n";
+			break;
+		case 2:
+			out += "printf(\"row %d: a + b = { " + std::to_string(a) + " } ; \", " + std::to_string(b) + ");\n";
+			break;
+		default:
+			out += "let h" + std::to_string(n) + " = {\"key " + std::to_string(a) + "\": true, \"b\": !false};\n";
+			break;
+		}
+	}
+	return out;
+}
+
+static bool sameTokens(const TokenStream& a, const TokenStream& b) {
+	if (a.size() != b.size())
+	{
+		return false;
+	}
+	for (size_t i = 0; i < a.size(); i++) {
+		if (a.kind(i) != b.kind(i) || a.offset(i) != b.offset(i) || a.length(i) != b.length(i) ||
+			a.symbol(i) != b.symbol(i))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char** argv) {
+	if (argc == 4 && std::string(argv[1]) == "generate")
+	{
+		std::ofstream(argv[2], std::ios::binary) << generate(std::strtoull(argv[3], nullptr, 10));
+		return 0;
+	}
+	if (argc < 2)
+	{
+		std::fprintf(stderr, "usage: lex_bench generate <file> <MiB>\n       lex_bench <file> [threads] [runs]\n");
+		return 1;
+	}
+	std::ifstream file(argv[1], std::ios::binary);
+	if (!file)
+	{
+		std::fprintf(stderr, "lex_bench: cannot read %s\n", argv[1]);
+		return 1;
+	}
+	std::stringstream read;
+	read << file.rdbuf();
+	std::string source = read.str();
+	unsigned maxThreads = resolveThreads(argc > 2 ? std::atoi(argv[2]) : 0);
+	int runs = argc > 3 ? std::max(1, std::atoi(argv[3])) : 3;
+
+	TokenStream reference(source);
+	std::printf("%s: %.1f MiB, %zu tokens, %u hardware threads\n", argv[1], source.size() / 1048576.0,
+		reference.size(), std::thread::hardware_concurrency());
+	std::printf("threads  seconds   MiB/s  speedup\n");
+	double serial = 0;
+	for (unsigned threads = 1; threads <= maxThreads; threads++) {
+		double best = 0;
+		for (int run = 0; run < runs; run++) {
+			auto start = std::chrono::steady_clock::now();
+			TokenStream tokens(source, threads);
+			std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+			if (!sameTokens(tokens, reference))
+			{
+				std::fprintf(stderr, "lex_bench: %u threads give other tokens than the serial lexer\n", threads);
+				return 1;
+			}
+			best = run == 0 ? seconds.count() : std::min(best, seconds.count());
+		}
+		if (threads == 1)
+		{
+			serial = best;
+		}
+		std::printf("%7u  %7.3f  %6.0f  %7.2f\n", threads, best, source.size() / 1048576.0 / best, serial / best);
+	}
+	return 0;
+}
@@ -0,0 +1,24 @@
+# Writes OUTPUT, a header defining CMINUS_REVISION: the git revision of
+# SOURCE_DIR, with a hash of the uncommitted changes when there are any,
+# or "unknown" outside git. It runs on every build and rewrites OUTPUT
+# only when the revision changed, so an unchanged one rebuilds nothing.
+execute_process(COMMAND git rev-parse HEAD
+  WORKING_DIRECTORY ${SOURCE_DIR} OUTPUT_VARIABLE revision
+  OUTPUT_STRIP_TRAILING_WHITESPACE ERROR_QUIET RESULT_VARIABLE status)
+if(NOT status EQUAL 0 OR revision STREQUAL "")
+  set(revision "unknown")
+else()
+  execute_process(COMMAND git diff HEAD
+    WORKING_DIRECTORY ${SOURCE_DIR} OUTPUT_VARIABLE changes ERROR_QUIET)
+  if(NOT changes STREQUAL "")
+    string(SHA256 changesHash "${changes}")
+    set(revision "${revision}+${changesHash}")
+  endif()
+endif()
+set(content "#define CMINUS_REVISION \"${revision}\"\n")
+if(EXISTS ${OUTPUT})
+  file(READ ${OUTPUT} previous)
+endif()
+if(NOT content STREQUAL previous)
+  file(WRITE ${OUTPUT} "${content}")
+endif()
@@ -1,7 +1,460 @@
 #include "cminus.h"
 #include <string>
+#include <fstream>
 #include <iostream>
-int main() {
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FileUtilities.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/xxhash.h"
+
+static llvm::cl::list<std::string> InputFiles(llvm::cl::Positional,
+	llvm::cl::desc("<source files> (- for stdin)"));
+static llvm::cl::opt<unsigned> LexThreads("lex-threads",
+	llvm::cl::desc("Threads used to tokenize large files (0: one per core)"),
+	llvm::cl::init(0));
+static llvm::cl::opt<unsigned> ParseThreads("parse-threads",
+	llvm::cl::desc("Threads used to parse the functions of large files (0: one per core)"),
+	llvm::cl::init(0));
+static llvm::cl::opt<char> OptLevel("O",
+	llvm::cl::desc("Optimization level: -O0, -O1, -O2, -O3, -Os or -Oz (default -O0)"),
+	llvm::cl::Prefix, llvm::cl::init('0'));
+static llvm::cl::opt<std::string> Target("target",
+	llvm::cl::desc("Generate code for this target triple instead of the host"),
+	llvm::cl::value_desc("triple"));
+enum class Emit { IR, Bitcode, Object, Executable, None };
+static llvm::cl::opt<Emit> EmitKind("emit",
+	llvm::cl::desc("What to write for each input"),
+	llvm::cl::values(
+		clEnumValN(Emit::IR, "ll", "Textual IR, foo.ll (default)"),
+		clEnumValN(Emit::Bitcode, "bc", "Bitcode, foo.bc"),
+		clEnumValN(Emit::Object, "obj", "An object file for the target, foo.o"),
+		clEnumValN(Emit::Executable, "exe", "An executable, foo, linked with the installed ld.lld or ld"),
+		clEnumValN(Emit::None, "none", "Nothing: compile, verify and optimize only")),
+	llvm::cl::init(Emit::IR));
+static llvm::cl::opt<std::string> OutputFile("o",
+	llvm::cl::desc("Write the output of the (single) input to this file, - for stdout"),
+	llvm::cl::value_desc("file"));
+static llvm::cl::opt<bool> Run("run",
+	llvm::cl::desc("Run the program on the JIT instead of writing its IR; exits with what main returns"));
+static llvm::cl::opt<bool> Interpret("interpret",
+	llvm::cl::desc("Run the program on the tiered engine: interpreted at once, hot functions compiled on the JIT"));
+static llvm::cl::opt<unsigned> HotThreshold("hot-threshold",
+	llvm::cl::desc("Calls and loop iterations after which --interpret compiles a function"),
+	llvm::cl::init(1000));
+static llvm::cl::opt<bool> TimeReport("time-report",
+	llvm::cl::desc("Print the time spent lexing, parsing, generating code and in each optimization pass"));
+static llvm::cl::opt<std::string> CompileCacheDir("compile-cache",
+	llvm::cl::desc("Keep what is compiled in this directory and reuse it while the source, compiler and options are the same"),
+	llvm::cl::value_desc("dir"));
+static llvm::cl::opt<bool> PrintAst("print-ast",
+	llvm::cl::desc("Print the parsed program to stdout instead of compiling it"));
+static llvm::cl::opt<bool> AstCache("ast-cache",
+	llvm::cl::desc("Keep the parsed program of foo.cm in foo.ast and use it while foo.cm is unchanged"));
+
+/*
+* the pipeline -O selects
+*/
+static llvm::OptimizationLevel optimizationLevel() {
+	switch (OptLevel)
+	{
+	case '1':
+		return llvm::OptimizationLevel::O1;
+	case '2':
+		return llvm::OptimizationLevel::O2;
+	case '3':
+		return llvm::OptimizationLevel::O3;
+	case 's':
+		return llvm::OptimizationLevel::Os;
+	case 'z':
+		return llvm::OptimizationLevel::Oz;
+	default:
+		return llvm::OptimizationLevel::O0;
+	}
+}
+
+/*
+* the compile cache of --compile-cache, or null
+*/
+static CompileCache* compileCache() {
+	static auto cache = CompileCacheDir.empty() ? nullptr : std::make_unique<CompileCache>(CompileCacheDir);
+	return cache.get();
+}
+
+/*
+* the key of what `source` compiles to with these options: it covers the
+* compiler (see Cminus::compilerId), -O and the target
+*/
+static std::string programKey(llvm::StringRef source) {
+	char level = OptLevel;
+	auto target = Target.empty() ? llvm::sys::getDefaultTargetTriple() + " " + llvm::sys::getHostCPUName().str()
+		: llvm::Triple::normalize(Target);
+	return CompileCache::key({ source, Cminus::compilerId(), llvm::StringRef(&level, 1), target });
+}
+
+/*
+* the key of the program of `key` written as `output`
+*/
+static std::string outputKey(const std::string& key, Cminus::Output output) {
+	switch (output)
+	{
+	case Cminus::Output::Bitcode:
+		return CompileCache::key({ key, "bc" });
+	case Cminus::Output::Object:
+		return CompileCache::key({ key, "o" });
+	default:
+		return CompileCache::key({ key, "ll" });
+	}
+}
+
+static bool writeFile(const std::string& path, llvm::StringRef data) {
+	if (path == "-")
+	{
+		llvm::outs() << data;
+		return true;
+	}
+	std::error_code error;
+	llvm::raw_fd_ostream out(path, error);
+	if (!error)
+	{
+		out << data;
+		out.close();
+		error = out.error();
+	}
+	if (error)
+	{
+		llvm::errs() << "cminus: cannot write " << path << ": " << error.message() << "\n";
+		out.clear_error();
+		return false;
+	}
+	return true;
+}
+
+/*
+* writes the program to `path` as `output` and, unless it went to stdout,
+* keeps a copy in the compile cache under `key`
+*/
+static bool emit(Cminus& cm, Cminus::Output output, const std::string& path, const std::string& key) {
+	if (!cm.exec(output, path, optimizationLevel()))
+	{
+		return false;
+	}
+	if (compileCache() != nullptr && !key.empty() && path != "-")
+	{
+		auto written = llvm::MemoryBuffer::getFile(path, /* IsText*/false,
+			/* RequiresNullTerminator*/false);
+		if (!written || !compileCache()->store(outputKey(key, output), (*written)->getBuffer()))
+		{
+			llvm::errs() << "cminus: cannot write to the compile cache " << CompileCacheDir << "\n";
+		}
+	}
+	return true;
+}
+
+/*
+* reports the syntax errors of an input; a program with any is neither
+* compiled nor run
+*/
+static int printSyntaxErrors(const std::vector<std::string>& errors) {
+	for (auto& error : errors) {
+		llvm::errs() << "cminus: " << error << "\n";
+	}
+	return 1;
+}
+
+/*
+* links the object `writeObject` writes to a temporary file into the
+* executable base, or -o
+*/
+static int linkExecutable(Cminus& cm, const std::string& base, llvm::function_ref<bool(const std::string&)> writeObject) {
+	// the object file is only a step on the way
+	llvm::SmallString<128> object;
+	if (llvm::sys::fs::createTemporaryFile("cminus", "o", object))
+	{
+		llvm::errs() << "cminus: cannot create a temporary object file\n";
+		return 1;
+	}
+	llvm::FileRemover removeObject(object);
+	std::string objects[] = { std::string(object) };
+	return writeObject(objects[0]) && cm.link(objects, OutputFile.empty() ? base : OutputFile) ? 0 : 1;
+}
+
+/*
+* generates the code of a parsed program and writes what --emit asks for
+* to -o, or next to the input: base.ll, base.bc, base.o or, linked, base
+* itself. With --run or --interpret it runs it instead. With a compile
+* cache, what is compiled is kept there under `key` (see programKey)
+*/
+static int finish(Cminus& cm, const std::string& base, const std::string& key = "") {
+	if (!cm.syntaxErrors().empty())
+	{
+		return printSyntaxErrors(cm.syntaxErrors());
+	}
+	if (!Target.empty())
+	{
+		cm.setTarget(Target);
+	}
+	if (compileCache() != nullptr && !key.empty())
+	{
+		cm.setCache(compileCache(), key);
+	}
+	if (Interpret)
+	{
+		auto status = cm.interpret(optimizationLevel(), HotThreshold);
+		return status ? static_cast<int>(*status) : 1;
+	}
+	if (Run)
+	{
+		auto status = cm.run(optimizationLevel());
+		return status ? static_cast<int>(*status) : 1;
+	}
+	switch (EmitKind)
+	{
+	case Emit::Bitcode:
+		return emit(cm, Cminus::Output::Bitcode, OutputFile.empty() ? base + ".bc" : OutputFile, key) ? 0 : 1;
+	case Emit::Object:
+		return emit(cm, Cminus::Output::Object, OutputFile.empty() ? base + ".o" : OutputFile, key) ? 0 : 1;
+	case Emit::Executable:
+		return linkExecutable(cm, base, [&](const std::string& object) {
+			return emit(cm, Cminus::Output::Object, object, key);
+		});
+	case Emit::None:
+		return cm.exec(Cminus::Output::None, "", optimizationLevel()) ? 0 : 1;
+	default:
+		return emit(cm, Cminus::Output::IR, OutputFile.empty() ? base + ".ll" : OutputFile, key) ? 0 : 1;
+	}
+}
+
+/*
+* does what finish() would with what the compile cache keeps for `key`,
+* nothing lexed, parsed or compiled; false when it keeps nothing for it.
+* --run takes main's object from there; --interpret always needs the
+* program
+*/
+static bool fromCompileCache(const std::string& key, const std::string& base, int& status) {
+	if (Interpret)
+	{
+		return false;
+	}
+	if (Run)
+	{
+		// looked up once: an entry going away after this is not a miss
+		// any more, the source is gone
+		auto object = compileCache()->lookup(Cminus::jitKey(key, "main"));
+		if (object == nullptr)
+		{
+			return false;
+		}
+		Cminus cm;
+		auto result = cm.run(std::move(object));
+		status = result ? static_cast<int>(*result) : 1;
+		return true;
+	}
+	if (EmitKind == Emit::None)
+	{
+		return false;
+	}
+	auto output = EmitKind == Emit::Bitcode ? Cminus::Output::Bitcode
+		: EmitKind == Emit::IR ? Cminus::Output::IR : Cminus::Output::Object;
+	auto cached = compileCache()->lookup(outputKey(key, output));
+	if (cached == nullptr)
+	{
+		return false;
+	}
+	switch (EmitKind)
+	{
+	case Emit::Bitcode:
+		status = writeFile(OutputFile.empty() ? base + ".bc" : OutputFile, cached->getBuffer()) ? 0 : 1;
+		break;
+	case Emit::Object:
+		status = writeFile(OutputFile.empty() ? base + ".o" : OutputFile, cached->getBuffer()) ? 0 : 1;
+		break;
+	case Emit::Executable:
+	{
+		Cminus cm;
+		if (!Target.empty())
+		{
+			cm.setTarget(Target);
+		}
+		status = linkExecutable(cm, base, [&](const std::string& object) {
+			return writeFile(object, cached->getBuffer());
+		});
+		break;
+	}
+	default:
+		status = writeFile(OutputFile.empty() ? base + ".ll" : OutputFile, cached->getBuffer()) ? 0 : 1;
+		break;
+	}
+	return true;
+}
+
+/*
+* the parsed program of `source` from its AST cache, mapped and used in
+* place, or null when there is no cache or it is stale
+*/
+static std::unique_ptr<FlatAst> loadAstCache(const std::string& cachePath, llvm::StringRef source) {
+	auto image = llvm::MemoryBuffer::getFile(cachePath, /* IsText*/false,
+		/* RequiresNullTerminator*/false);
+	if (!image)
+	{
+		return nullptr;
+	}
+	std::shared_ptr<const llvm::MemoryBuffer> owner = std::move(*image);
+	auto data = owner->getBuffer();
+	return FlatAst::load({ data.data(), data.size() }, llvm::xxHash64(source), source.size(), owner);
+}
+
+/*
+* writes the AST cache of `source`. It goes to a temporary file renamed
+* over the cache, so a compiler running at the same time never maps a
+* half written one
+*/
+static void saveAstCache(const std::string& cachePath, const FlatAst& program, llvm::StringRef source) {
+	llvm::SmallString<128> tempPath;
+	if (llvm::sys::fs::createUniqueFile(cachePath + "-%%%%%%.tmp", tempPath))
+	{
+		llvm::errs() << "cminus: cannot write " << cachePath << "\n";
+		return;
+	}
+	std::ofstream out(std::string(tempPath), std::ios::binary | std::ios::trunc);
+	program.write(out, llvm::xxHash64(source), source.size());
+	out.close();
+	if (!out || llvm::sys::fs::rename(tempPath, cachePath))
+	{
+		llvm::errs() << "cminus: cannot write " << cachePath << "\n";
+		llvm::sys::fs::remove(tempPath);
+	}
+}
+
+/*
+* streams the parsed program to stdout, one top-level statement at a time
+*/
+static int printAst(Parser& parser) {
+	auto program = parser.ParserProgram(ParseThreads);
+	if (!parser.errors().empty())
+	{
+		return printSyntaxErrors(parser.errors());
+	}
+	program->Write(llvm::outs());
+	llvm::outs() << "\n";
+	return 0;
+}
+
+/*
+* compiles one input: files are memory mapped read-only and lexed in place
+* on --lex-threads threads, and their functions parsed on --parse-threads
+* threads; "-" is read as a stream in chunks. foo.cm is written to
+* foo.ll (see --emit and -o), stdin to ./out.ll, unless they are run.
+* With --ast-cache the front end is skipped while foo.ast matches foo.cm;
+* with --compile-cache all of the compiler is, when it has compiled the
+* same source with the same options before
+*/
+static int compileInput(const std::string& path) {
+	static llvm::TimerGroup timers("cminus", "cminus compile time");
+	static llvm::Timer lexTimer("lex", "Lexing", timers);
+	static llvm::Timer parseTimer("parse", "Parsing and lowering", timers);
+	static llvm::Timer compileTimer("compile", "Name resolution, code generation and optimization", timers);
+	static llvm::Timer cacheTimer("ast-cache", "Reading and writing the AST cache", timers);
+	if (path == "-")
+	{
+		std::ios::sync_with_stdio(false);
+		if (PrintAst)
+		{
+			Parser parser{ std::cin };
+			return printAst(parser);
+		}
+		Cminus cm{ std::cin };
+		return finish(cm, "./out");
+	}
+	auto buffer = llvm::MemoryBuffer::getFile(path, /* IsText*/false,
+		/* RequiresNullTerminator*/false);
+	if (!buffer)
+	{
+		llvm::errs() << "cminus: cannot read " << path << ": " << buffer.getError().message() << "\n";
+		return 1;
+	}
+	llvm::SmallString<128> outFile(path);
+	llvm::sys::path::replace_extension(outFile, "");
+	llvm::SmallString<128> cacheFile(path);
+	llvm::sys::path::replace_extension(cacheFile, "ast");
+	auto source = (*buffer)->getBuffer();
+	std::string key;
+	if (compileCache() != nullptr && !PrintAst)
+	{
+		key = programKey(source);
+		if (int status; fromCompileCache(key, std::string(outFile), status))
+		{
+			return status;
+		}
+	}
+	if (AstCache && !PrintAst)
+	{
+		std::unique_ptr<FlatAst> cached;
+		{
+			llvm::TimeRegion region(TimeReport ? &cacheTimer : nullptr);
+			cached = loadAstCache(std::string(cacheFile), source);
+		}
+		if (cached != nullptr)
+		{
+			llvm::TimeRegion region(TimeReport ? &compileTimer : nullptr);
+			Cminus cm{ std::move(cached) };
+			return finish(cm, std::string(outFile), key);
+		}
+	}
+	std::shared_ptr<const TokenStream> tokens;
+	{
+		llvm::TimeRegion region(TimeReport ? &lexTimer : nullptr);
+		tokens = std::make_shared<TokenStream>(source, LexThreads);
+	}
+	if (PrintAst)
+	{
+		Parser parser{ tokens };
+		return printAst(parser);
+	}
+	Cminus cm{ tokens, ParseThreads };
+	{
+		llvm::TimeRegion region(TimeReport ? &parseTimer : nullptr);
+		cm.program();
+	}
+	if (!cm.syntaxErrors().empty())
+	{
+		return printSyntaxErrors(cm.syntaxErrors());
+	}
+	if (AstCache)
+	{
+		llvm::TimeRegion region(TimeReport ? &cacheTimer : nullptr);
+		saveAstCache(std::string(cacheFile), cm.program(), source);
+	}
+	llvm::TimeRegion region(TimeReport ? &compileTimer : nullptr);
+	return finish(cm, std::string(outFile), key);
+}
+
+int main(int argc, char** argv) {
+	llvm::cl::ParseCommandLineOptions(argc, argv, "cminus compiler\n");
+	if (std::string_view("0123sz").find(OptLevel.getValue()) == std::string_view::npos)
+	{
+		llvm::errs() << "cminus: unknown optimization level -O" << OptLevel.getValue() << "\n";
+		return 1;
+	}
+	// the time report covers each pass of the optimizer too
+	llvm::TimePassesIsEnabled |= TimeReport;
+	if (!OutputFile.empty() && InputFiles.size() > 1)
+	{
+		llvm::errs() << "cminus: -o needs a single input\n";
+		return 1;
+	}
+	if (!InputFiles.empty())
+	{
+		int status = 0;
+		for (auto& path : InputFiles) {
+			status |= compileInput(path);
+		}
+		return status;
+	}
+	// no inputs: compile the built-in sample program
 	const std::string program = R"(
 	version;
 	let b = 11 * 11;
@@ -29,8 +482,7 @@ int main() {
     }
 
 	mut b = hi(113,21);
-	}
 )";
 	Cminus cm{ program };
-	cm.exec();
+	return finish(cm, "./out");
 }
\ No newline at end of file
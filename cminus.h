@@ -2,73 +2,623 @@
 #define CMINUS_H
 #include "parser.h"
 #include "ast.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Config/llvm-config.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/StandardInstrumentations.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/TargetParser/Host.h"
+#include <cstdio>
+#include <format>
+#include <optional>
 #include <variant>
-#include "src/Environment.h"
+#include "src/CompileCache.h"
+#include "src/FlatAst.h"
+#include "src/Interpreter.h"
+#include "src/Linker.h"
+#include "src/Resolver.h"
+#if __has_include("Revision.h")
+#include "Revision.h" // written by the build, see cmake/Revision.cmake
+#endif
+#ifndef CMINUS_REVISION
+#define CMINUS_REVISION "unknown"
+#endif
 class Cminus {
 public:
-	Cminus(const std::string& input) :parser(std::make_unique<Parser>(input)) {
+	/*
+	* input is not copied, it must outlive the compiler
+	*/
+	Cminus(std::string_view input) :parser(std::make_unique<Parser>(input)) {
+		ctx = std::make_unique<llvm::LLVMContext>();
+	}
+	/*
+	* compiles a stream (stdin, a pipe) read in chunks
+	*/
+	Cminus(std::istream& stream) :parser(std::make_unique<Parser>(stream)) {
+		ctx = std::make_unique<llvm::LLVMContext>();
+	}
+	/*
+	* compiles an already tokenized program, parsing top-level functions
+	* on parseThreads threads (0: one per core)
+	*/
+	Cminus(std::shared_ptr<const TokenStream> tokens, unsigned parseThreads = 1) :parser(std::make_unique<Parser>(std::move(tokens))), parseThreads(parseThreads) {
+		ctx = std::make_unique<llvm::LLVMContext>();
+	}
+	/*
+	* compiles a program lowered earlier (loaded from an AST cache), no
+	* lexing or parsing
+	*/
+	Cminus(std::unique_ptr<FlatAst> program) : flat(std::move(program)) {
+		ctx = std::make_unique<llvm::LLVMContext>();
+	}
+	/*
+	* a compiler with no program, for what needs none: linking objects, or
+	* running one found in the compile cache
+	*/
+	Cminus() : Cminus(std::string_view()) {}
+	/*
+	* what exec() writes: textual IR, bitcode, an object file for the
+	* target, or nothing (the module is compiled, verified and optimized)
+	*/
+	enum class Output { IR, Bitcode, Object, None };
+	/*
+	* compiles the program at `level` and writes it to `path` ("-" for
+	* stdout) as `output`
+	*/
+	bool exec(Output output = Output::IR, const std::string& path = "./out.ll", llvm::OptimizationLevel level = llvm::OptimizationLevel::O0) {
+		module = compile();
+		if (module == nullptr)
+		{
+			printErrors();
+			return false;
+		}
+		optimize(*module, level);
+		if (output == Output::None)
+		{
+			return true;
+		}
+		if (!saveModuleToFile(output, path))
+		{
+			printErrors();
+			return false;
+		}
+		return true;
+	}
+	/*
+	* generates code for `triple` (e.g. aarch64-linux-gnu) instead of the
+	* host, from the next compile on
+	*/
+	void setTarget(const std::string& triple) {
+		targetTriple = triple;
+		target.reset();
+	}
+	/*
+	* Bump when the code generated for a program changes, so that a
+	* CompileCache no longer serves what older compilers made
+	*/
+	static constexpr uint32_t CodegenVersion = 1;
+	/*
+	* the compiler, in the keys of a CompileCache: its codegen version, the
+	* revision it was built from, the flat form it lowers to and its LLVM
+	*/
+	static std::string compilerId() {
+		return std::format("cminus {} ({}), flat {}, LLVM {}", CodegenVersion, CMINUS_REVISION,
+			FlatAst::CacheVersion, LLVM_VERSION_STRING);
+	}
+	/*
+	* keeps the objects the JIT compiles in `objects` and takes them from
+	* there rather than compiling again. `program` is the key of the
+	* program and of everything its code depends on (see CompileCache::key)
+	*/
+	void setCache(CompileCache* objects, std::string program) {
+		cache = objects;
+		programKey = std::move(program);
+	}
+	/*
+	* the key of the object the JIT runs `name` of `program` from: objects
+	* are for the host, and for its CPU
+	*/
+	static std::string jitKey(const std::string& program, llvm::StringRef name) {
+		return CompileCache::key({ program, "jit", llvm::sys::getProcessTriple(), llvm::sys::getHostCPUName(), name });
+	}
+	/*
+	* links object files into an executable for the target with the
+	* installed linker (see Linker)
+	*/
+	bool link(std::span<const std::string> objects, const std::string& path) {
+		auto machine = targetMachine();
+		if (machine == nullptr)
+		{
+			printErrors();
+			return false;
+		}
+		Linker linker(machine->getTargetTriple());
+		if (!linker.link(objects, path))
+		{
+			errors = linker.errors();
+			printErrors();
+			return false;
+		}
+		return true;
+	}
+	/*
+	* compiles the program and runs it in process on the ORC JIT, printf
+	* and any other external function resolving to the host's own. Returns
+	* what main returns, nothing when the program could not be run
+	*/
+	std::optional<int64_t> run(llvm::OptimizationLevel level = llvm::OptimizationLevel::O0) {
+		if (auto cached = cachedObject("main"))
+		{
+			return run(std::move(cached));
+		}
+		auto program = compile();
+		if (program == nullptr)
+		{
+			printErrors();
+			return std::nullopt;
+		}
+		optimize(*program, level);
+		return runMain(addToJit(std::move(program), "main", "main"));
+	}
+	/*
+	* runs main from an object compiled earlier, taken from a CompileCache
+	* (see jitKey); the compiler's own program is not used
+	*/
+	std::optional<int64_t> run(std::unique_ptr<llvm::MemoryBuffer> object) {
+		return runMain(addToJit(std::move(object), "main"));
+	}
+	/*
+	* runs the program on the tiered engine: the Interpreter starts on the
+	* flat form at once, and a function called or looping `threshold` times
+	* is compiled at `level` on the JIT, its later calls running natively.
+	* Returns what main returns, nothing when the program failed
+	*/
+	std::optional<int64_t> interpret(llvm::OptimizationLevel level, uint32_t threshold) {
+		errors = frontEndErrors();
+		if (!errors.empty())
+		{
+			printErrors();
+			return std::nullopt;
+		}
+		Interpreter interpreter(program(), resolution(), [&](NodeId function, std::span<const NodeId> callees) {
+			// the callees are part of the code: which function a name calls
+			// is only known when the caller gets hot
+			auto name = entryName(function);
+			auto key = name;
+			for (auto callee : callees) {
+				key += "," + std::to_string(callee);
+			}
+			Interpreter::Native native = nullptr;
+			if (auto cached = cachedObject(key))
+			{
+				native = reinterpret_cast<Interpreter::Native>(addToJit(std::move(cached), name));
+			}
+			else if (auto tier = compileFunction(function, callees))
+			{
+				optimize(*tier, level);
+				native = reinterpret_cast<Interpreter::Native>(addToJit(std::move(tier), name, key));
+			}
+			// declined: the function stays interpreted
+			errors.clear();
+			return native;
+		}, threshold);
+		interpreter.define(versionSlot, Interpreter::Value::ofInt(1, 32));
+		interpreter.define(printfSlot, Interpreter::Value::printf());
+		auto result = interpreter.run();
+		fflush(stdout);
+		if (!result)
+		{
+			errors = interpreter.errors();
+			printErrors();
+		}
+		return result;
+	}
+	/*
+	* the program, parsed and lowered on first use. Codegen only reads it,
+	* so it is kept for every later compile
+	*/
+	const FlatAst& program() {
+		if (flat == nullptr) {
+			// codegen walks the flat form; the node tree goes as soon as it is lowered
+			flat = std::make_unique<FlatAst>(*parser->ParserProgram(parseThreads));
+			syntax = parser->errors();
+		}
+		return *flat;
+	}
+	/*
+	* the syntax errors of the program; a program with any is not compiled
+	* or run. None for a program loaded from an AST cache
+	*/
+	const std::vector<std::string>& syntaxErrors() {
+		program();
+		return syntax;
+	}
+	/*
+	* the names of the program bound to slots, resolved on first use along
+	* with the runtime's own: version, main and the external printf, which
+	* programs may call
+	*/
+	const Resolution& resolution() {
+		if (resolved == nullptr) {
+			auto& symbols = SymbolTable::global();
+			Resolver resolver(program());
+			resolver.external(symbols.intern("printf"));
+			printfSlot = resolver.predefine(symbols.intern("printf"));
+			versionSlot = resolver.predefine(symbols.intern("version"));
+			resolver.external(symbols.intern("main"));
+			mainSlot = resolver.predefine(symbols.intern("main"));
+			resolved = std::make_unique<Resolution>(std::move(resolver).run());
+		}
+		return *resolved;
+	}
+	/*
+	* generates a new module from the program, starting from a clean
+	* module, builders and global environment each time: compiling again
+	* (at another optimization level, for another target) needs no new
+	* lexing or parsing. Modules live in the compiler's LLVMContext and
+	* must not outlive it
+	*/
+	std::unique_ptr<llvm::Module> compile() {
+		errors = frontEndErrors();
+		if (!errors.empty())
+		{
+			return nullptr;
+		}
 		moduleInit();
 		setupExternalFunctions();
 		setupGlobalEnvironment();
+		compile(program());
+		verify();
+		if (!errors.empty())
+		{
+			module.reset();
+		}
+		return std::move(module);
+	}
+	/*
+	* generates a module with the function defined at `function`, the
+	* functions it calls (`callees`, in the order to define them) and an
+	* entry taking the function's arguments from an array of 64-bit cells
+	* and writing its result to the first (see Interpreter::Native), named
+	* after the function's node. Null when the function uses a name that
+	* is not its own parameter, local or callee; callees are internal, so
+	* that modules with copies of the same one link side by side
+	*/
+	std::unique_ptr<llvm::Module> compileFunction(NodeId function, std::span<const NodeId> callees) {
+		errors = frontEndErrors();
+		if (!errors.empty())
+		{
+			return nullptr;
+		}
+		moduleInit();
+		setupExternalFunctions();
+		ast = &program();
+		auto cellType = builder->getInt64Ty();
+		fn = llvm::Function::Create(llvm::FunctionType::get(builder->getVoidTy(), { cellType->getPointerTo() }, false),
+			llvm::Function::ExternalLinkage, entryName(function), *module);
+		createFunctionBlock(fn);
+		auto entry = fn;
+		for (auto callee : callees)
+		{
+			eval(callee);
+		}
+		auto target = llvm::dyn_cast_or_null<llvm::Function>(eval(function));
+		ast = nullptr;
+		if (target == nullptr || !errors.empty())
+		{
+			errors.push_back("cannot compile the function alone");
+			module.reset();
+			return nullptr;
+		}
+		std::vector<llvm::Value*> args;
+		for (auto& param : target->args())
+		{
+			auto cell = builder->CreateConstGEP1_64(cellType, entry->getArg(0), param.getArgNo());
+			args.push_back(builder->CreateLoad(param.getType(), builder->CreatePointerCast(cell, param.getType()->getPointerTo())));
+		}
+		auto result = builder->CreateCall(target, args);
+		if (!result->getType()->isVoidTy())
+		{
+			builder->CreateStore(result, builder->CreatePointerCast(entry->getArg(0), result->getType()->getPointerTo()));
+		}
+		builder->CreateRetVoid();
+		for (auto& defined : *module)
+		{
+			if (&defined != entry && !defined.isDeclaration())
+			{
+				defined.setLinkage(llvm::Function::InternalLinkage);
+			}
+		}
+		verify();
+		if (!errors.empty())
+		{
+			module.reset();
+		}
+		return std::move(module);
 	}
-	void exec() {
-		auto ast = parser->ParserProgram();
-		compile(ast);
-		module->print(llvm::outs(), nullptr);
-		saveModuleToFile("./out.ll");
+	/*
+	* runs the standard new pass manager pipeline of `level` over a module
+	* from compile(), tuned for the host: SROA, instcombine, GVN, the loop
+	* passes and, from O2 on, the loop and SLP vectorizers. O0 runs only the
+	* passes that must run. Each pass is timed with -time-passes
+	*/
+	void optimize(llvm::Module& module, llvm::OptimizationLevel level) {
+		llvm::LoopAnalysisManager loopAnalyses;
+		llvm::FunctionAnalysisManager functionAnalyses;
+		llvm::CGSCCAnalysisManager cgsccAnalyses;
+		llvm::ModuleAnalysisManager moduleAnalyses;
+		llvm::PassInstrumentationCallbacks callbacks;
+		llvm::StandardInstrumentations instrumentations(*ctx, /* DebugLogging*/false);
+		instrumentations.registerCallbacks(callbacks, &moduleAnalyses);
+
+		llvm::PipelineTuningOptions tuning;
+		tuning.LoopVectorization = level.getSpeedupLevel() > 1;
+		tuning.SLPVectorization = level.getSpeedupLevel() > 1;
+		llvm::PassBuilder passBuilder(targetMachine(), tuning, std::nullopt, &callbacks);
+		passBuilder.registerModuleAnalyses(moduleAnalyses);
+		passBuilder.registerCGSCCAnalyses(cgsccAnalyses);
+		passBuilder.registerFunctionAnalyses(functionAnalyses);
+		passBuilder.registerLoopAnalyses(loopAnalyses);
+		passBuilder.crossRegisterProxies(loopAnalyses, functionAnalyses, cgsccAnalyses, moduleAnalyses);
+
+		auto passes = level == llvm::OptimizationLevel::O0
+			? passBuilder.buildO0DefaultPipeline(level)
+			: passBuilder.buildPerModuleDefaultPipeline(level);
+		passes.run(module, moduleAnalyses);
 	}
+	/*
+	* what made the last compile() fail
+	*/
+	std::vector<std::string> errors;
 private:
-	void moduleInit(void) {
+	/*
+	* reports the module generated, if it has no errors yet, when it is
+	* not valid IR
+	*/
+	void verify() {
+		if (errors.empty())
+		{
+			std::string problems;
+			llvm::raw_string_ostream out(problems);
+			if (llvm::verifyModule(*module, &out))
+			{
+				errors.push_back("invalid module: " + out.str());
+			}
+		}
+	}
+	static std::string entryName(NodeId function) {
+		return "tier" + std::to_string(function);
+	}
+	/*
+	* the ORC JIT programs run on, created on first use. Its main dylib
+	* resolves external functions to those of the compiler's process. With
+	* a cache (see setCache) its compiler keeps and reuses objects there
+	*/
+	llvm::orc::LLJIT* jitEngine() {
+		if (jit == nullptr)
+		{
+			llvm::InitializeNativeTarget();
+			llvm::InitializeNativeTargetAsmPrinter();
+			llvm::orc::LLJITBuilder builder;
+			if (cache != nullptr)
+			{
+				builder.setCompileFunctionCreator([objects = cache](llvm::orc::JITTargetMachineBuilder machine)
+					-> llvm::Expected<std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler>> {
+					return std::make_unique<llvm::orc::ConcurrentIRCompiler>(std::move(machine), objects);
+				});
+			}
+			auto created = builder.create();
+			if (!created)
+			{
+				errors.push_back(llvm::toString(created.takeError()));
+				return nullptr;
+			}
+			auto host = llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess((*created)->getDataLayout().getGlobalPrefix());
+			if (!host)
+			{
+				errors.push_back(llvm::toString(host.takeError()));
+				return nullptr;
+			}
+			(*created)->getMainJITDylib().addGenerator(std::move(*host));
+			jit = std::move(*created);
+		}
+		return jit.get();
+	}
+	/*
+	* adds a module to the JIT and returns the address of its symbol `name`,
+	* or null. The module takes the compiler's LLVMContext along; later
+	* compiles get a new one. With a cache its object is kept there, under
+	* the key of `cached` (see cachedObject)
+	*/
+	void* addToJit(std::unique_ptr<llvm::Module> code, const std::string& name, const std::string& cached) {
+		auto engine = jitEngine();
+		if (engine == nullptr)
+		{
+			return nullptr;
+		}
+		if (cache != nullptr)
+		{
+			// the ObjectCache finds modules by their identifier
+			code->setModuleIdentifier(jitKey(programKey, cached));
+		}
+		llvm::orc::ThreadSafeModule jitted(std::move(code), llvm::orc::ThreadSafeContext(std::move(ctx)));
 		ctx = std::make_unique<llvm::LLVMContext>();
+		if (auto error = engine->addIRModule(std::move(jitted)))
+		{
+			errors.push_back(llvm::toString(std::move(error)));
+			return nullptr;
+		}
+		return lookupInJit(name);
+	}
+	/*
+	* adds an object compiled earlier to the JIT and returns the address of
+	* its symbol `name`, or null
+	*/
+	void* addToJit(std::unique_ptr<llvm::MemoryBuffer> object, const std::string& name) {
+		auto engine = jitEngine();
+		if (engine == nullptr)
+		{
+			return nullptr;
+		}
+		if (auto error = engine->addObjectFile(std::move(object)))
+		{
+			errors.push_back(llvm::toString(std::move(error)));
+			return nullptr;
+		}
+		return lookupInJit(name);
+	}
+	/*
+	* the object the cache keeps for `name` (see jitKey), or null
+	*/
+	std::unique_ptr<llvm::MemoryBuffer> cachedObject(const std::string& name) const {
+		return cache != nullptr ? cache->lookup(jitKey(programKey, name)) : nullptr;
+	}
+	/*
+	* calls main at `entry`, null when it could not be added to the JIT
+	*/
+	std::optional<int64_t> runMain(void* entry) {
+		auto main = reinterpret_cast<int64_t (*)()>(entry);
+		if (main == nullptr)
+		{
+			printErrors();
+			return std::nullopt;
+		}
+		auto result = main();
+		fflush(stdout);
+		return result;
+	}
+	void* lookupInJit(const std::string& name) {
+		auto symbol = jit->lookup(name);
+		if (!symbol)
+		{
+			errors.push_back(llvm::toString(symbol.takeError()));
+			return nullptr;
+		}
+		return symbol->toPtr<void*>();
+	}
+	/*
+	* what keeps the program from being compiled: its syntax errors, else
+	* its name errors
+	*/
+	const std::vector<std::string>& frontEndErrors() {
+		return !syntaxErrors().empty() ? syntaxErrors() : resolution().errors();
+	}
+	void printErrors() {
+		for (auto& error : errors) {
+			llvm::errs() << "cminus: " << error << "\n";
+		}
+	}
+	/*
+	* a fresh module and builders in the compiler's context
+	*/
+	void moduleInit(void) {
+		values.assign(resolution().slots(), nullptr);
 		module = std::make_unique<llvm::Module>("cminus", *ctx);
+		if (auto target = targetMachine())
+		{
+			module->setDataLayout(target->createDataLayout());
+			module->setTargetTriple(target->getTargetTriple().str());
+		}
 		builder = std::make_unique<llvm::IRBuilder<>>(*ctx);
 		variableBuilder = std::make_unique<llvm::IRBuilder<>>(*ctx);
+		fn = nullptr;
+	}
+	/*
+	* the machine code is generated for, the host's unless setTarget() says
+	* otherwise, created on first use; it also tells the optimizer the data
+	* layout, vector widths and costs to plan for. Null, with an error, when
+	* LLVM was built without that target
+	*/
+	llvm::TargetMachine* targetMachine() {
+		if (target == nullptr)
+		{
+			bool host = targetTriple.empty();
+			if (host)
+			{
+				llvm::InitializeNativeTarget();
+				llvm::InitializeNativeTargetAsmPrinter();
+			}
+			else
+			{
+				llvm::InitializeAllTargetInfos();
+				llvm::InitializeAllTargets();
+				llvm::InitializeAllTargetMCs();
+				llvm::InitializeAllAsmPrinters();
+			}
+			auto triple = host ? llvm::sys::getDefaultTargetTriple() : llvm::Triple::normalize(targetTriple);
+			std::string error;
+			auto machine = llvm::TargetRegistry::lookupTarget(triple, error);
+			if (machine == nullptr)
+			{
+				errors.push_back(error);
+				return nullptr;
+			}
+			target.reset(machine->createTargetMachine(triple, host ? llvm::sys::getHostCPUName() : "generic", "",
+				llvm::TargetOptions(), llvm::Reloc::PIC_));
+		}
+		return target.get();
 	}
 	void setupExternalFunctions() {
-		module->getOrInsertFunction("printf", llvm::FunctionType::get(
+		auto printf = module->getOrInsertFunction("printf", llvm::FunctionType::get(
 			/* return type*/builder->getInt32Ty(),
 			/* format arg char*/builder->getInt8Ty()->getPointerTo(),
 			/* var args*/true));
+		values[printfSlot] = printf.getCallee();
 	}
-	void compile(std::shared_ptr<Program> ast) {
+	void compile(const FlatAst& program) {
+		ast = &program;
 		// 1. create main function
-		fn = createFunction("main", llvm::FunctionType::get(/* return type*/ builder->getInt64Ty(),/* varargs*/false), GlobalEnv);
+		fn = createFunction(SymbolTable::global().intern("main"), llvm::FunctionType::get(/* return type*/ builder->getInt64Ty(),/* varargs*/false), mainSlot);
 		// 2. compile main body
-		//eval(ast,GlobalEnv);
-		for (size_t i = 0; i < ast->Statements.size(); i++)
+		//eval(ast);
+		for (auto stmt : ast->roots())
 		{
-			eval(ast->Statements[i], GlobalEnv);
+			eval(stmt);
 		}
+		builder->CreateRet(builder->getInt64(0));
+		ast = nullptr;
 	}
-	//TODO: implement this
-	llvm::Value* eval(std::shared_ptr<Node> node, std::shared_ptr<Environment> env) {
-		if (dynamic_cast<ExpressionStatement*>(node.get()) != nullptr) {
-			auto expr = dynamic_cast<ExpressionStatement*>(node.get());
-			return eval(std::move(expr->Expression), env);
+	/*
+	* generates the code of `node` where the builder is; its value, or null
+	* after an error
+	*/
+	llvm::Value* eval(NodeId node) {
+		if (node == FlatAst::None)
+		{
+			return builder->getInt32(0);
 		}
-		if (dynamic_cast<WhileExpression*>(node.get()) != nullptr)
+		switch (ast->kind(node))
+		{
+		case NodeKind::ExpressionStatement:
+			return eval(ast->first(node));
+		case NodeKind::While:
 		{
-			auto expr = dynamic_cast<WhileExpression*>(node.get());
 			auto conditionBlcok = createBB("condition", fn);
 			builder->CreateBr(conditionBlcok);
 
-			auto bodyBlock = createBB("body", fn);
-			auto loopendBlock = createBB("end", fn);
+			auto bodyBlock = createBB("body");
+			auto loopendBlock = createBB("end");
 
 			builder->SetInsertPoint(conditionBlcok);
-			auto cond = eval(std::move(expr->Condition), env);
+			auto cond = eval(ast->first(node));
 			if (cond == nullptr)
 			{
 				return nullptr;
 			}
-			builder->CreateCondBr(cond, bodyBlock, loopendBlock);
+			builder->CreateCondBr(truth(cond), bodyBlock, loopendBlock);
 			fn->insert(fn->end(), bodyBlock);
 			builder->SetInsertPoint(bodyBlock);
-			eval(std::move(expr->Body), env);
+			eval(ast->second(node));
 			builder->CreateBr(conditionBlcok);
 
 			fn->insert(fn->end(), loopendBlock);
@@ -76,38 +626,38 @@ private:
 
 			return builder->getInt32(0);
 		}
-		if (dynamic_cast<BlockStatement*>(node.get()) != nullptr)
+		case NodeKind::Block:
 		{
-			auto block = dynamic_cast<BlockStatement*>(node.get());
-			auto blockEnv = std::make_shared<Environment>(std::map<std::string, llvm::Value*>{}, env);
-			llvm::Value* blockRes = nullptr;
-			for (auto i = 0; i < block->Statements.size(); i++)
+			llvm::Value* blockRes = builder->getInt32(0);
+			for (auto stmt : ast->list(ast->first(node)))
 			{
-				auto stmt = std::move(block->Statements[i]);
-				if (dynamic_cast<ReturnStatement*>(stmt.get()) != nullptr)
+				if (stmt != FlatAst::None && ast->kind(stmt) == NodeKind::Return)
 				{
-					blockRes = eval(std::move(stmt), blockEnv);
+					blockRes = eval(stmt);
 					return blockRes;
 				}
-				blockRes = eval(std::move(stmt), blockEnv);
+				blockRes = eval(stmt);
 			}
 			// return the last block result
 			return blockRes;
 
 		}
-		if (dynamic_cast<IfExpression*>(node.get()) != nullptr)
+		case NodeKind::If:
 		{
-			auto ifexpr = dynamic_cast<IfExpression*>(node.get());
-			auto cond = eval(std::move(ifexpr->Condition), env);
+			auto cond = eval(ast->first(node));
+			if (cond == nullptr)
+			{
+				return nullptr;
+			}
 
 			// consequence block
 			auto consequenceBlock = createBB("consequence", fn);
-			auto elseBlock = createBB("else", fn);
-			auto ifEndBlock = createBB("end", fn);
-			builder->CreateCondBr(cond, consequenceBlock, elseBlock);
+			auto elseBlock = createBB("else");
+			auto ifEndBlock = createBB("end");
+			builder->CreateCondBr(truth(cond), consequenceBlock, elseBlock);
 
 			builder->SetInsertPoint(consequenceBlock);
-			auto conseqResult = eval(std::move(ifexpr->Consequence), env);
+			auto conseqResult = eval(ast->second(node));
 			if (conseqResult == nullptr)
 			{
 				return nullptr;
@@ -119,189 +669,237 @@ private:
 
 			fn->insert(fn->end(), elseBlock);
 			builder->SetInsertPoint(elseBlock);
-			auto alternativeResult = eval(std::move(ifexpr->Alternative), env);
+			auto alternativeResult = eval(ast->third(node));
 			if (alternativeResult == nullptr)
 			{
 				return nullptr;
 			}
+			// the if has the type of its consequence, when the alternative converts to it
+			alternativeResult = convert(alternativeResult, conseqResult->getType());
 			builder->CreateBr(ifEndBlock);
 			elseBlock = builder->GetInsertBlock();
 
 			fn->insert(fn->end(), ifEndBlock);
 
 			builder->SetInsertPoint(ifEndBlock);
+			if (alternativeResult == nullptr || conseqResult->getType()->isVoidTy())
+			{
+				return builder->getInt32(0);
+			}
 
-			auto phi = builder->CreatePHI(cond->getType(), 2, "tmpif");
+			auto phi = builder->CreatePHI(conseqResult->getType(), 2, "tmpif");
 			phi->addIncoming(conseqResult, consequenceBlock);
 			phi->addIncoming(alternativeResult, elseBlock);
 			return phi;
 
 		}
-		if (dynamic_cast<StringLiteral*>(node.get()) != nullptr)
+		case NodeKind::String:
+			return builder->CreateGlobalString(ast->text(ast->first(node)));
+		case NodeKind::Return:
 		{
-			auto str = dynamic_cast<StringLiteral*>(node.get());
-			return builder->CreateGlobalString(str->Value);
+			auto val = eval(ast->first(node));
+			if (val == nullptr)
+			{
+				return nullptr;
+			}
+			createReturn(val);
+			// what follows a return is unreachable, it goes to a block of its own
+			builder->SetInsertPoint(createBB("unreachable", fn));
+			return builder->getInt32(0);
 		}
-		if (dynamic_cast<ReturnStatement*>(node.get()) != nullptr)
+		case NodeKind::Let:
 		{
-			auto rt = dynamic_cast<ReturnStatement*>(node.get());
-			auto val = eval(std::move(rt->ReturnValue), env);
-			builder->CreateRet(val);
-		}
-
-		if (dynamic_cast<LetStatement*>(node.get()) != nullptr) {
-			auto stmt = dynamic_cast<LetStatement*>(node.get());
-			auto val = eval(std::move(stmt->Value), env);
+			auto val = eval(ast->second(node));
 			if (val == nullptr)
 			{
 				return val;
 			}
-			if (stmt->Token.Type.compare(MUT) == 0)
+			auto name = ast->symbol(ast->first(node));
+			if (ast->op(node) == MUT)
 			{
-				auto MutBinding = env->lookup(stmt->Name->Value);
-				return builder->CreateStore(val, MutBinding);
+				auto MutBinding = valueOf(node);
+				if (MutBinding == nullptr)
+				{
+					return nullptr;
+				}
+				auto type = variableType(MutBinding);
+				auto converted = type != nullptr ? convert(val, type) : nullptr;
+				if (converted == nullptr)
+				{
+					errors.push_back(std::format("cannot assign to {}", ast->name(ast->first(node))));
+					return nullptr;
+				}
+				return builder->CreateStore(converted, MutBinding);
 
 			}
 
-			auto letBinding = allocateVariable(stmt->Name->Value, val->getType(), env);
+			auto letBinding = allocateVariable(name, val->getType(), resolution().binding(node));
 			builder->CreateStore(val, letBinding);
 			return val;
 		}
-		if (dynamic_cast<FunctionLiteral*>(node.get()) != nullptr)
+		case NodeKind::Function:
 		{
-			auto fnLiteral = (dynamic_cast<FunctionLiteral*>(node.get()));
-			auto params = std::move(fnLiteral->Parameters);
+			auto params = ast->list(ast->second(node));
 			auto v = vector<llvm::Type*>(); // parameters types
-			auto names = vector<std::string>(); // parameters names
-			for (auto& p : params) {
-				v.push_back(getTypeFromIdentifier(p->type));
-			}
-			for (auto& p : params) {
-				names.push_back(p->Token.Literal);
+			for (auto p : params) {
+				v.push_back(getTypeFromIdentifier(ast->op(p)));
 			}
-			auto body = std::move(fnLiteral->Body);
+			auto body = ast->third(node);
 			llvm::FunctionType* fnType = nullptr;
-			if (fnLiteral->Type.Literal == VOID)
+			if (ast->op(node) == VOID)
 			{
 				fnType = llvm::FunctionType::get(builder->getVoidTy(), v, true);
 			}
-			if (fnLiteral->Type.Literal == BOOLEAN)
+			if (ast->op(node) == BOOLEAN)
 			{
 				fnType = llvm::FunctionType::get(builder->getInt1Ty(), v, true);
 			}
-			if (fnLiteral->Type.Literal == I8)
+			if (ast->op(node) == I8)
 			{
 				fnType = llvm::FunctionType::get(builder->getInt8Ty(), v, true);
 			}
-			if (fnLiteral->Type.Literal == I16)
+			if (ast->op(node) == I16)
 			{
 				fnType = llvm::FunctionType::get(builder->getInt16Ty(), v, true);
 			}
-			if (fnLiteral->Type.Literal == I32)
+			if (ast->op(node) == I32)
 			{
 				fnType = llvm::FunctionType::get(builder->getInt32Ty(), v, true);
 			}
-			if (fnLiteral->Type.Literal == I64)
+			if (ast->op(node) == I64)
 			{
 				fnType = llvm::FunctionType::get(builder->getInt64Ty(), v, true);
 			}
-			if (fnLiteral->Type.Literal == FLOAT)
+			if (ast->op(node) == FLOAT)
 			{
 				fnType = llvm::FunctionType::get(builder->getFloatTy(), v, true);
 			}
-			if (fnLiteral->Type.Literal == DOUBLE)
+			if (ast->op(node) == DOUBLE)
 			{
 				fnType = llvm::FunctionType::get(builder->getDoubleTy(), v, true);
 			}
 			auto prevFn = fn;
 			auto prevBlock = builder->GetInsertBlock();
 
-			auto function = createFunction(fnLiteral->ident.Literal, fnType, env);
-			auto fnEnv = setFunctionArgs(function, names, env); // function environment
+			auto function = createFunction(ast->symbol(ast->first(node)), fnType, resolution().binding(node));
 			fn = function;
+			setFunctionArgs(function, params);
 
+			auto result = eval(body);
+			if (result != nullptr)
+			{
+				createReturn(result);
+			}
 			// restore the previous fn location
-			builder->CreateRet(eval(std::move(body), fnEnv));
 			builder->SetInsertPoint(prevBlock);
 			fn = prevFn;
 
 			return function;
 		}
-		if (dynamic_cast<CallExpression*>(node.get()) != nullptr)
+		case NodeKind::Call:
 		{
-			auto fn = dynamic_cast<CallExpression*>(node.get());
-			auto function = eval(std::move(fn->Function), env);
+			auto function = eval(ast->first(node));
 			if (function == nullptr)
 			{
 				return function;
 			}
+			auto func = llvm::dyn_cast<llvm::Function>(function);
+			if (func == nullptr)
+			{
+				errors.push_back("call of a value that is not a function");
+				return nullptr;
+			}
+			auto argNodes = ast->list(ast->second(node));
+			if (argNodes.size() < func->arg_size())
+			{
+				errors.push_back(std::format("too few arguments to {}", func->getName().str()));
+				return nullptr;
+			}
 			std::vector<llvm::Value*> args{};
 
-			for (auto& a : fn->Arguments) {
-				auto arg = eval(std::move(a), env);
+			for (auto a : argNodes) {
+				auto arg = eval(a);
+				if (arg == nullptr)
+				{
+					return nullptr;
+				}
+				// arguments take the types of the parameters, extra ones are promoted as in C
+				if (args.size() < func->arg_size())
+				{
+					arg = convert(arg, func->getArg(args.size())->getType());
+					if (arg == nullptr)
+					{
+						errors.push_back(std::format("bad argument to {}", func->getName().str()));
+						return nullptr;
+					}
+				}
+				else if (arg->getType()->isIntegerTy() && arg->getType()->getIntegerBitWidth() < 32)
+				{
+					arg = convert(arg, builder->getInt32Ty());
+				}
+				else if (arg->getType()->isFloatTy())
+				{
+					arg = convert(arg, builder->getDoubleTy());
+				}
 				args.push_back(arg);
 			}
 
-			auto func = (llvm::Function*)function;
 			return builder->CreateCall(func,args);
 
 		}
-		if (dynamic_cast<Identifier*>(node.get()) != nullptr)
+		case NodeKind::Identifier:
 		{
-			llvm::Value* result = evalIdentifier(node, env);
+			llvm::Value* result = evalIdentifier(node);
 			return result;
 		}
-		if (dynamic_cast<IntegerLiteral*>(node.get()) != nullptr) {
-			auto number = dynamic_cast<IntegerLiteral*>(node.get());
-			return builder->getInt32(number->Value);
-		}
-		if (dynamic_cast<FloatLiteral*>(node.get()) != nullptr) {
-			auto number = dynamic_cast<FloatLiteral*>(node.get());
-			return llvm::ConstantFP::get(builder->getDoubleTy(), number->Value);
-		}
-		if (dynamic_cast<Boolean*>(node.get()) != nullptr)
+		case NodeKind::Integer:
+			return builder->getInt32(ast->integer(node));
+		case NodeKind::Float:
+			return llvm::ConstantFP::get(builder->getDoubleTy(), ast->real(node));
+		case NodeKind::Boolean:
+			return builder->getInt1(ast->first(node) != 0);
+		case NodeKind::Prefix:
 		{
-			auto b = dynamic_cast<Boolean*>(node.get());
-			return builder->getInt1(b->Value);
-		}
-		if (dynamic_cast<PrefixExpression*>(node.get()) != nullptr) {
-			auto prefix = dynamic_cast<PrefixExpression*>(node.get());
-			auto right = eval(std::move(prefix->Right), env);
+			auto right = eval(ast->first(node));
 			if (right == nullptr)
 			{
 				return right;
 			}
-			if (prefix->Operator.compare("!") == 0)
+			if (ast->op(node) == BANG)
 			{
 				return builder->CreateNot(right);
 			}
-			if (prefix->Operator.compare("-") == 0)
+			if (ast->op(node) == MINUS)
 			{
-				return builder->CreateNeg(right);
+				return right->getType()->isFloatingPointTy() ? builder->CreateFNeg(right) : builder->CreateNeg(right);
 			}
+			errors.push_back(std::format("unsupported operator {}", TokenTypeString(ast->op(node))));
 			return nullptr;
 		}
-		if (dynamic_cast<InfixExpression*>(node.get()) != nullptr)
+		case NodeKind::Infix:
 		{
-			auto infix = dynamic_cast<InfixExpression*>(node.get());
-			auto left = eval(std::move(infix->Left), env);
+			auto left = eval(ast->first(node));
 			if (left == nullptr)
 			{
 				return left;
 			}
-			auto right = eval(std::move(infix->Right), env);
+			auto right = eval(ast->second(node));
 			if (right == nullptr)
 			{
 				return right;
 			}
-			return evalInfixExpression(infix->Operator, left, right);
+			auto result = evalInfixExpression(TokenTypeString(ast->op(node)), left, right);
+			if (result == nullptr)
+			{
+				errors.push_back(std::format("unsupported operator {}", TokenTypeString(ast->op(node))));
+			}
+			return result;
 		}
-		if (dynamic_cast<ArrayLiteral*>(node.get())!=nullptr)
+		case NodeKind::Array:
 		{
-			auto arr = dynamic_cast<ArrayLiteral*>(node.get());
 			auto result = vector<llvm::Value*>();
-			for (auto& exp : arr->Elements) {
-				auto evaluated = eval(std::move( exp), env);
+			for (auto exp : ast->list(ast->first(node))) {
+				auto evaluated = eval(exp);
 				if (evaluated == nullptr)
 				{
 					return evaluated;
@@ -318,58 +916,81 @@ private:
 			}
 			return builder->CreateGEP(arrType, arrayAlloc, { builder->getInt32(0), builder->getInt32(0) });
 		}
-		return builder->getInt32(0);
+		default:
+			return builder->getInt32(0);
+		}
 	}
 
-
-	void saveModuleToFile(const std::string& filename) {
-		std::error_code error_code;
-		llvm::raw_fd_ostream outLL(filename, error_code);
-		module->print(outLL, nullptr);
+	bool saveModuleToFile(Output output, const std::string& filename) {
+		std::error_code error;
+		llvm::raw_fd_ostream out(filename, error, output == Output::IR ? llvm::sys::fs::OF_Text : llvm::sys::fs::OF_None);
+		if (error)
+		{
+			errors.push_back(std::format("cannot write {}: {}", filename, error.message()));
+			return false;
+		}
+		if (output == Output::IR)
+		{
+			module->print(out, nullptr);
+		}
+		if (output == Output::Bitcode)
+		{
+			llvm::WriteBitcodeToFile(*module, out);
+		}
+		if (output == Output::Object)
+		{
+			llvm::legacy::PassManager codegen;
+			if (targetMachine()->addPassesToEmitFile(codegen, out, nullptr, llvm::CodeGenFileType::ObjectFile))
+			{
+				errors.push_back("the target cannot write object files");
+				return false;
+			}
+			codegen.run(*module);
+		}
+		return true;
 	}
 
 	void setupGlobalEnvironment() {
-		auto record = map<std::string, llvm::Value*>();
-		GlobalEnv = std::make_shared<Environment>(record, nullptr);
-		GlobalEnv->define("version", createGlobal("version", (llvm::Constant*)builder->getInt32(1)));
+		values[versionSlot] = createGlobal("version", (llvm::Constant*)builder->getInt32(1));
 	}
 
 	/**
-	* creates a function
+	* creates a function, held by `slot` when it is a new one
 	*/
-	llvm::Function* createFunction(const std::string& fnName, llvm::FunctionType* fnType, std::shared_ptr<Environment> env) {
+	llvm::Function* createFunction(Symbol fnName, llvm::FunctionType* fnType, uint32_t slot) {
 		// function prototype may already be defined
-		auto fn = module->getFunction(fnName);
+		auto fn = module->getFunction(SymbolTable::global().name(fnName));
 		// if not, allocate the function
 		if (fn == nullptr)
 		{
-			fn = createFunctionProto(fnName, fnType, env);
+			fn = createFunctionProto(fnName, fnType, slot);
 		}
 		createFunctionBlock(fn);
 		return fn;
 	}
 	/*
-	* set the names of the function arguments
+	* set the names of the function arguments, from the parameter nodes
 	*/
-	std::shared_ptr<Environment> setFunctionArgs(llvm::Function* fn, std::vector<std::string> fnArgs, std::shared_ptr<Environment> env) {
-		auto fnEnv = std::make_shared<Environment>(std::map<std::string, llvm::Value*>{}, env);
-
+	void setFunctionArgs(llvm::Function* fn, std::span<const NodeId> params) {
 
 		unsigned Idx = 0;
 		for (auto& arg : fn->args()) {
-			auto argBinding = allocateVariable(fnArgs[Idx], arg.getType(), fnEnv);
-			arg.setName(fnArgs[Idx++]);
+			auto name = ast->symbol(ast->first(params[Idx]));
+			auto argBinding = allocateVariable(name, arg.getType(), resolution().binding(params[Idx++]));
+			arg.setName(SymbolTable::global().name(name));
 			builder->CreateStore(&arg, argBinding);
 		}
-		return fnEnv;
 	}
 	/**
 	* Creates function prototype (defines the function, but not the body)
 	*/
-	llvm::Function* createFunctionProto(const std::string& fnName, llvm::FunctionType* fnType, std::shared_ptr<Environment> env) {
-		auto fn = llvm::Function::Create(fnType, llvm::Function::ExternalLinkage, fnName, *module);
+	llvm::Function* createFunctionProto(Symbol fnName, llvm::FunctionType* fnType, uint32_t slot) {
+		auto fn = llvm::Function::Create(fnType, llvm::Function::ExternalLinkage, SymbolTable::global().name(fnName), *module);
 		verifyFunction(*fn);
-		env->define(fnName, fn);
+		if (slot != Resolution::None)
+		{
+			values[slot] = fn;
+		}
 		return fn;
 	}
 	void createFunctionBlock(llvm::Function* fn) {
@@ -408,82 +1029,203 @@ private:
 		llvm::GlobalVariable* gVar = module->getNamedGlobal(name);
 		gVar->setInitializer(init);
 		gVar->setConstant(false);
-		gVar->setLinkage(llvm::GlobalVariable::CommonLinkage);
+		gVar->setLinkage(llvm::GlobalVariable::InternalLinkage);
 		return gVar;
 	}
 
 	/*
-	* Allocates a variable on the stack
+	* Allocates a variable on the stack, ahead of the first instruction of
+	* the function. The variables of the top level (main) are globals
+	* instead, the functions defined there may use them
 	*/
-	llvm::Value* allocateVariable(const std::string& name, llvm::Type* type_, std::shared_ptr<Environment>env) {
-		variableBuilder->SetInsertPoint(&fn->getEntryBlock());
-
-		auto allocatedVariable = variableBuilder->CreateAlloca(type_, 0, name.c_str());
-		env->define(name, allocatedVariable);
+	llvm::Value* allocateVariable(Symbol name, llvm::Type* type_, uint32_t slot) {
+		llvm::Value* allocatedVariable = nullptr;
+		if (fn == values[mainSlot])
+		{
+			allocatedVariable = new llvm::GlobalVariable(*module, type_, /* isConstant*/false,
+				llvm::GlobalVariable::InternalLinkage, llvm::Constant::getNullValue(type_), SymbolTable::global().name(name));
+		}
+		else
+		{
+			auto& entry = fn->getEntryBlock();
+			variableBuilder->SetInsertPoint(&entry, entry.getFirstInsertionPt());
+			allocatedVariable = variableBuilder->CreateAlloca(type_, 0, SymbolTable::global().name(name));
+		}
+		values[slot] = allocatedVariable;
 		return allocatedVariable;
 	}
-
-	llvm::Type* getTypeFromIdentifier(const std::string& type_) {
-		if (type_.compare(BOOLEAN) == 0)
+	/*
+	* the type of the value a variable holds, null if `variable` is not one
+	*/
+	llvm::Type* variableType(llvm::Value* variable) {
+		if (auto local = llvm::dyn_cast<llvm::AllocaInst>(variable))
 		{
-			return builder->getInt1Ty();
+			return local->getAllocatedType();
 		}
-		if (type_.compare(I8) == 0)
+		if (auto global = llvm::dyn_cast<llvm::GlobalVariable>(variable))
 		{
-			return builder->getInt8Ty();
+			return global->getValueType();
 		}
-		if (type_.compare(I16) == 0)
+		return nullptr;
+	}
+	/*
+	* `value` converted to `type`: integers are extended or truncated, as
+	* signed values except booleans, and converted to and from floating
+	* point. Null when there is no such conversion
+	*/
+	llvm::Value* convert(llvm::Value* value, llvm::Type* type) {
+		auto from = value->getType();
+		if (from == type)
 		{
-			return builder->getInt16Ty();
+			return value;
 		}
-		if (type_.compare(I32) == 0)
+		bool isSigned = !from->isIntegerTy(1);
+		if (from->isIntegerTy() && type->isIntegerTy())
 		{
-			return builder->getInt32Ty();
+			return builder->CreateIntCast(value, type, isSigned);
 		}
-		if (type_.compare(I64) == 0)
+		if (from->isIntegerTy() && type->isFloatingPointTy())
 		{
-			return builder->getInt64Ty();
+			return isSigned ? builder->CreateSIToFP(value, type) : builder->CreateUIToFP(value, type);
 		}
-		if (type_.compare(FLOAT) == 0)
+		if (from->isFloatingPointTy() && type->isIntegerTy())
 		{
-			return builder->getFloatTy();
+			return type->isIntegerTy(1) ? truth(value) : builder->CreateFPToSI(value, type);
 		}
-		if (type_.compare(DOUBLE) == 0)
+		if (from->isFloatingPointTy() && type->isFloatingPointTy())
 		{
-			return builder->getDoubleTy();
+			return builder->CreateFPCast(value, type);
+		}
+		if (from->isPointerTy() && type->isPointerTy())
+		{
+			return builder->CreatePointerCast(value, type);
 		}
 		return nullptr;
 	}
+	/*
+	* `value` as a condition: true when it is not zero (or null)
+	*/
+	llvm::Value* truth(llvm::Value* value) {
+		auto type = value->getType();
+		if (type->isIntegerTy(1))
+		{
+			return value;
+		}
+		if (type->isFloatingPointTy())
+		{
+			return builder->CreateFCmpUNE(value, llvm::ConstantFP::get(type, 0.0));
+		}
+		if (type->isPointerTy())
+		{
+			return builder->CreateIsNotNull(value);
+		}
+		return builder->CreateICmpNE(value, llvm::Constant::getNullValue(type));
+	}
+	/*
+	* returns `value` from the current function, converted to its return type
+	*/
+	void createReturn(llvm::Value* value) {
+		auto type = fn->getReturnType();
+		if (type->isVoidTy())
+		{
+			builder->CreateRetVoid();
+		}
+		else
+		{
+			auto converted = convert(value, type);
+			if (converted == nullptr)
+			{
+				errors.push_back(std::format("{} returns a value of the wrong type", fn->getName().str()));
+				converted = llvm::UndefValue::get(type);
+			}
+			builder->CreateRet(converted);
+		}
+	}
 
-
-	llvm::Value* evalProgram(shared_ptr<Node> node, std::shared_ptr<Environment> env) {
-		llvm::Value* result = nullptr;
-		auto program = dynamic_cast<Program*>(node.get());
-		for (size_t i = 0; i < program->Statements.size(); i++)
+	llvm::Type* getTypeFromIdentifier(TokenType type_) {
+		switch (type_)
 		{
-			result = eval(program->Statements[i], env);
+		case BOOLEAN:
+			return builder->getInt1Ty();
+		case I8:
+			return builder->getInt8Ty();
+		case I16:
+			return builder->getInt16Ty();
+		case I32:
+			return builder->getInt32Ty();
+		case I64:
+			return builder->getInt64Ty();
+		case FLOAT:
+			return builder->getFloatTy();
+		case DOUBLE:
+			return builder->getDoubleTy();
+		default:
+			return nullptr;
 		}
-		return result;
 	}
-	llvm::Value* evalIdentifier(shared_ptr<Node> node, std::shared_ptr<Environment> env) {
-		auto ident = dynamic_cast<Identifier*>(node.get());
-		auto value = env->lookup(ident->Value);
+	/*
+	* the value of the slot a name is bound to. A declaration whose
+	* initializer failed to compile leaves its slot without one; that is
+	* reported and compiling goes on, but no module is produced
+	*/
+	llvm::Value* valueOf(NodeId node) {
+		auto value = values[resolution().binding(node)];
+		if (value == nullptr)
+		{
+			errors.push_back(std::format("{} has no value", ast->name(ast->first(node))));
+		}
+		return value;
+	}
+	llvm::Value* evalIdentifier(NodeId node) {
+		auto name = ast->name(ast->first(node));
+		auto value = valueOf(node);
+		if (value == nullptr)
+		{
+			return nullptr;
+		}
 
 		// local variable
 		if (auto localValue = dyn_cast<llvm::AllocaInst>(value))
 		{
-			return builder->CreateLoad(localValue->getAllocatedType(), localValue, ident->Value.c_str());
+			return builder->CreateLoad(localValue->getAllocatedType(), localValue, llvm::StringRef(name));
 		}
 
 		// global variable
 		if (auto globalValue = dyn_cast<llvm::GlobalVariable>(value))
 		{
-			return builder->CreateLoad(globalValue->getInitializer()->getType(), globalValue, ident->Value.c_str());
+			return builder->CreateLoad(globalValue->getValueType(), globalValue, llvm::StringRef(name));
 		}
 		return value;
 	}
 
-	llvm::Value* evalInfixExpression(const std::string& op, llvm::Value* left, llvm::Value* right) {
+	llvm::Value* evalInfixExpression(std::string_view op, llvm::Value* left, llvm::Value* right) {
+		// logical operations are on the truth of their operands
+		if (op.compare("or") == 0)
+		{
+			return builder->CreateOr(truth(left), truth(right));
+		}
+		if (op.compare("and") == 0)
+		{
+			return builder->CreateAnd(truth(left), truth(right));
+		}
+		// mixed operands are converted to the wider type, floating point being wider than integers
+		auto leftType = left->getType();
+		auto rightType = right->getType();
+		if (leftType != rightType && (leftType->isIntegerTy() || leftType->isFloatingPointTy())
+			&& (rightType->isIntegerTy() || rightType->isFloatingPointTy()))
+		{
+			bool leftWider = leftType->isFloatingPointTy() != rightType->isFloatingPointTy()
+				? leftType->isFloatingPointTy()
+				: leftType->getPrimitiveSizeInBits() > rightType->getPrimitiveSizeInBits();
+			if (leftWider)
+			{
+				right = convert(right, leftType);
+			}
+			else
+			{
+				left = convert(left, rightType);
+			}
+		}
 		// float operations
 		if (left->getType()->isFloatingPointTy() && right->getType()->isFloatingPointTy())
 		{
@@ -592,14 +1334,6 @@ private:
 			// not implemented
 		}
 
-		if (op.compare("or") == 0)
-		{
-			return builder->CreateOr(left, right);
-		}
-		if (op.compare("and") == 0)
-		{
-			return builder->CreateAnd(left, right);
-		}
 		if (op.compare("==") == 0)
 		{
 			return builder->getInt1(left == right);
@@ -611,21 +1345,47 @@ private:
 		return nullptr;
 	}
 
-
-	/*llvm::Value* evalExpression(shared_ptr<Node> node, std::shared_ptr<Environment> env) {
-
-	}*/
-
 	/*
 	* The pratt parser
 	*/
 	std::unique_ptr<Parser>parser;
+	unsigned parseThreads = 1;
+	/*
+	* The parsed program, see program()
+	*/
+	std::unique_ptr<FlatAst> flat;
+	std::vector<std::string> syntax;
+	/*
+	* The names of the program, see resolution()
+	*/
+	std::unique_ptr<Resolution> resolved;
+	uint32_t versionSlot = 0;
+	uint32_t mainSlot = 0;
+	uint32_t printfSlot = 0;
+	/*
+	* The program being compiled
+	*/
+	const FlatAst* ast = nullptr;
 	/*
 	* Global LLVM Context
 	* It owns and managaes the core "global" data of llvm's core
 	* infrastructure, including the type and constant unique tables
 	*/
 	std::unique_ptr<llvm::LLVMContext> ctx;
+	/*
+	* The machine code is planned for, see targetMachine()
+	*/
+	std::unique_ptr<llvm::TargetMachine> target;
+	std::string targetTriple; // empty: the host
+	/*
+	* The JIT that runs programs, see jitEngine()
+	*/
+	std::unique_ptr<llvm::orc::LLJIT> jit;
+	/*
+	* Where the JIT keeps its objects, see setCache()
+	*/
+	CompileCache* cache = nullptr;
+	std::string programKey;
 	/**
 	 * A Module instance is used to store all the information related to an
 	 * LLVM module. Modules are the top level container of all other LLVM
@@ -657,10 +1417,11 @@ private:
 	* specific iterator location in a block.
 	*/
 	std::unique_ptr<llvm::IRBuilder<>> builder;
-	llvm::Function* fn;
+	llvm::Function* fn = nullptr;
 
 	/**
-	* Global Environment (symbol table).
+	* Symbol table: the value of each slot of resolution(), as codegen
+	* creates them.
 	*/
-	std::shared_ptr<Environment> GlobalEnv;
+	std::vector<llvm::Value*> values;
 };
\ No newline at end of file
@@ -1,322 +1,459 @@
 #pragma once
 #define LEXER_H
-#include <cctype>
+#include <algorithm>
+#include <cstdint>
+#include <istream>
 #include <string>
-#include <unordered_map>
+#include <string_view>
 
-using namespace std;
+#include "src/CharClass.h"
+#include "src/LineIndex.h"
 
-typedef string TokenType;
+using namespace std;
 
-struct Token {
-  TokenType Type;
-  string Literal;
+enum TokenType : uint8_t {
+  ILLEGAL,
+  EOF_TOKEN,
+
+  // identifiers + literals
+  IDENT, // add , foobar ,x ,y ,...
+  INT,   // integers
+  FLT,
+  STRING,
+
+  // Operators
+  ASSIGN,
+  PLUS,
+  MINUS,
+  BANG,
+  ASTERISK,
+  SLASH,
+  MODULO,
+  LSHIFT,
+  RSHIFT,
+
+  LT,
+  GT,
+
+  EQ,
+  NOT_EQ,
+  LT_EQ,
+  GT_EQ,
+
+  LOGICAL_AND,
+  LOGICAL_OR,
+
+  // Delimiters
+  DOT,
+  COMMA,
+  SEMICOLON,
+
+  LPAREN,
+  RPAREN,
+  LBRACE,
+  RBRACE,
+
+  LBRACKET,
+  RBRACKET,
+
+  COLON,
+
+  // keywords
+  MACRO,
+  FUNCTION,
+  LET,
+  MUT,
+  TRUE,
+  FALSE,
+  IF,
+  ELSE,
+  RETURN,
+  WHILE,
+
+  // types
+  I64,
+  I32,
+  I16,
+  I8,
+  FLOAT,
+  DOUBLE,
+  BOOLEAN,
+  NONE,
+  VOID,
+
+  TOKEN_TYPE_COUNT
 };
 
-const string ILLEGAL = "ILLEGAL";
-const string EOF_TOKEN = "EOF";
-
-// identifiers + literals
-const string IDENT = "IDENT"; // add , foobar ,x ,y ,...
-const string INT = "INT";     // integers
-const string FLT = "FLOAT";
- 
-// Operators
-const string ASSIGN = "=";
-const string PLUS = "+";
-const string MINUS = "-";
-const string BANG = "!";
-const string ASTERISK = "*";
-const string SLASH = "/";
-const string MODULO = "%";
-const string LSHIFT = "<<";
-const string RSHIFT = ">>";
-
-const string LT = "<";
-const string GT = ">";
-
-const string EQ = "==";
-const string NOT_EQ = "!=";
-const string LT_EQ = "<=";
-const string GT_EQ = ">=";
-
-const string LOGICAL_AND = "and";
-const string LOGICAL_OR = "or";
-
-// Delimiters
-const string DOT = ".";
-const string COMMA = ",";
-const string SEMICOLON = ";";
-const string STRING = "STRING";
-
-const string LPAREN = "(";
-const string RPAREN = ")";
-const string LBRACE = "{";
-const string RBRACE = "}";
-
-const string LBRACKET = "[";
-const string RBRACKET = "]";
-
-const string COLON = ":";
-
-// keywords
-const string MACRO = "macro";
-const string FUNCTION = "func";
-const string LET = "let";
-const string MUT = "mut";
-const string TRUE = "true";
-const string FALSE = "false";
-const string IF = "if";
-const string ELSE = "else";
-const string RETURN = "return";
-const string WHILE = "while";
-
-// types
-const string I64 = "i64";
-const string I32 = "i32";
-const string I16 = "i16";
-const string I8 = "i8";
-const string FLOAT = "f32";
-const string DOUBLE = "f64";
-const string BOOLEAN = "i1";
-const string NONE = "None";
-const string VOID = "void";
-// language keywords
-
-inline unordered_map<string, TokenType> types = {
-    {"i64", I64}, {"i32", I32},{"i16",I16},{"i8",I8},{"void",VOID},{"f32",FLOAT},{"f64",DOUBLE},{"None",NONE},{"i1",BOOLEAN}
+// printable name of every token type, used in diagnostics
+inline constexpr string_view TokenTypeNames[TOKEN_TYPE_COUNT] = {
+    "ILLEGAL", "EOF",  "IDENT", "INT",    "FLOAT", "STRING", "=",     "+",
+    "-",       "!",    "*",     "/",      "%",     "<<",     ">>",    "<",
+    ">",       "==",   "!=",    "<=",     ">=",    "and",    "or",    ".",
+    ",",       ";",    "(",     ")",      "{",     "}",      "[",     "]",
+    ":",       "macro", "func", "let",    "mut",   "true",   "false", "if",
+    "else",    "return", "while", "i64",  "i32",   "i16",    "i8",    "f32",
+    "f64",     "i1",   "None",  "void",
 };
 
-inline unordered_map<string, TokenType> keywords = {
-    {"func", FUNCTION}, {"macro", MACRO},   {"let", LET},
-    {"true", TRUE},     {"false", FALSE},   {"if", IF},
-    {"else", ELSE},     {"return", RETURN}, {"and", LOGICAL_AND},
-    {"or", LOGICAL_OR}, {"while", WHILE},{"mut",MUT},
+constexpr string_view TokenTypeString(TokenType t) {
+  return t < TOKEN_TYPE_COUNT ? TokenTypeNames[t] : "ILLEGAL";
+}
+
+// type tokens (i32, f64, void, ...) start a function literal
+constexpr bool IsTypeToken(TokenType t) { return t >= I64 && t <= VOID; }
+
+// A token is a kind plus a view of its spelling in the lexer input; it does
+// not own any memory and stays valid as long as the input does (see
+// Lexer(istream&) for streams).
+struct Token {
+  TokenType Type = ILLEGAL;
+  string_view Literal;
 };
 
-// check to see if the given identifier is a keyword
-inline TokenType LookupIdent(const string &ident) {
-  if (keywords.find(ident) != keywords.end()) {
-    return keywords[ident];
+/*
+* Keyword and type lookup: a switch on length and one distinguishing char
+* picks the only candidate, which is then compared once. Nothing is
+* allocated and there is no global state, so lexers on several threads
+* can share it.
+*/
+constexpr TokenType LookupIdent(string_view ident) {
+  auto is = [&](TokenType t) { return ident == TokenTypeNames[t] ? t : IDENT; };
+  switch (ident.size()) {
+  case 2:
+    switch (ident[0]) {
+    case 'i':
+      return ident[1] == 'f' ? IF : ident[1] == '8' ? I8 : is(BOOLEAN);
+    case 'o':
+      return is(LOGICAL_OR);
+    }
+    break;
+  case 3:
+    switch (ident[0]) {
+    case 'l':
+      return is(LET);
+    case 'm':
+      return is(MUT);
+    case 'a':
+      return is(LOGICAL_AND);
+    case 'i':
+      return ident[1] == '6' ? is(I64) : ident[1] == '3' ? is(I32) : is(I16);
+    case 'f':
+      return ident[1] == '3' ? is(FLOAT) : is(DOUBLE);
+    }
+    break;
+  case 4:
+    switch (ident[0]) {
+    case 'f':
+      return is(FUNCTION);
+    case 't':
+      return is(TRUE);
+    case 'e':
+      return is(ELSE);
+    case 'v':
+      return is(VOID);
+    case 'N':
+      return is(NONE);
+    }
+    break;
+  case 5:
+    switch (ident[0]) {
+    case 'm':
+      return is(MACRO);
+    case 'f':
+      return is(FALSE);
+    case 'w':
+      return is(WHILE);
+    }
+    break;
+  case 6:
+    return is(RETURN);
   }
   return IDENT;
 }
 
-inline TokenType LookupType(const string& type) {
-    if (types.find(type) != types.end()) {
-        return types[type];
+static_assert([] {
+  for (int t = LOGICAL_AND; t < TOKEN_TYPE_COUNT; t++) {
+    TokenType expected = t <= LOGICAL_OR || t >= MACRO ? TokenType(t) : IDENT;
+    if (LookupIdent(TokenTypeNames[t]) != expected) {
+      return false;
     }
-    return IDENT;
-}
+  }
+  return LookupIdent("i") == IDENT && LookupIdent("i65") == IDENT &&
+         LookupIdent("returns") == IDENT;
+}(), "LookupIdent must know every keyword and type");
 
 class Lexer {
 public:
-  string input;
-  Lexer(const string &input = "")
-      : input(input), position(0), readPosition(0), ch(' '), line(1) {
+  // the text being scanned; the whole program, or the current window of a
+  // stream. The lexer never copies it, the caller keeps it alive.
+  string_view input;
+  Lexer(string_view input = {})
+      : input(input), position(0), readPosition(0), ch(' ') {
+    readChar();
+  }
+  // Streaming mode: reads `stream` in ChunkSize pieces so only one window of
+  // the source is held at a time. A token's literal is only valid until the
+  // next NextToken call; TokenStream copies what it keeps. The newlines of
+  // every chunk read are added to `lines`, if given.
+  Lexer(istream &stream, LineIndex *lines = nullptr)
+      : stream(&stream), lines(lines), position(0), readPosition(0),
+        ch(' ') {
     readChar();
   }
+  // token literals are views into `input`, so the lexer must stay put
+  Lexer(const Lexer &) = delete;
+  Lexer &operator=(const Lexer &) = delete;
+
+  static constexpr size_t ChunkSize = 1 << 16;
 
   Token NextToken() {
     Token tok;
 
     skipWhitespace();
+    tokenStart = position;
 
     switch (ch) {
     case '%':
-      tok = newToken(MODULO, ch);
+      tok = newToken(MODULO);
       break;
     case '=':
       if (peekChar() == '=') {
-        char ch = this->ch;
         readChar();
-        tok = Token{EQ, string(1, ch) + string(1, this->ch)};
+        tok = newToken(EQ, 2);
       } else {
-        tok = newToken(ASSIGN, ch);
+        tok = newToken(ASSIGN);
       }
       break;
     case '-':
-      tok = newToken(MINUS, ch);
+      tok = newToken(MINUS);
       break;
     case '!':
       if (peekChar() == '=') {
-        char ch = this->ch;
         readChar();
-        tok = Token{NOT_EQ, string(1, ch) + string(1, this->ch)};
+        tok = newToken(NOT_EQ, 2);
       } else {
-        tok = newToken(BANG, ch);
+        tok = newToken(BANG);
       }
       break;
     case '*':
-      tok = newToken(ASTERISK, ch);
+      tok = newToken(ASTERISK);
       break;
     case '/':
-      tok = newToken(SLASH, ch);
+      tok = newToken(SLASH);
       break;
     case '<':
       if (peekChar() == '=') {
-        char ch = this->ch;
         readChar();
-        tok = Token{LT_EQ, string(1, ch) + string(1, this->ch)};
+        tok = newToken(LT_EQ, 2);
       } else if (peekChar() == '<') {
-        char ch = this->ch;
         readChar();
-        tok = Token{LSHIFT, string(1, ch) + string(1, this->ch)};
+        tok = newToken(LSHIFT, 2);
       } else {
-        tok = newToken(LT, ch);
+        tok = newToken(LT);
       }
       break;
     case '>':
       if (peekChar() == '=') {
-        char ch = this->ch;
         readChar();
-        tok = Token{GT_EQ, string(1, ch) + string(1, this->ch)};
+        tok = newToken(GT_EQ, 2);
       } else if (peekChar() == '>') {
-        char ch = this->ch;
         readChar();
-        tok = Token{RSHIFT, string(1, ch) + string(1, this->ch)};
+        tok = newToken(RSHIFT, 2);
       } else {
-        tok = newToken(GT, ch);
+        tok = newToken(GT);
       }
       break;
     case ';':
-      tok = newToken(SEMICOLON, ch);
+      tok = newToken(SEMICOLON);
       break;
     case '(':
-      tok = newToken(LPAREN, ch);
+      tok = newToken(LPAREN);
       break;
     case ')':
-      tok = newToken(RPAREN, ch);
+      tok = newToken(RPAREN);
       break;
     case ',':
-      tok = newToken(COMMA, ch);
+      tok = newToken(COMMA);
       break;
     case '+':
-      tok = newToken(PLUS, ch);
+      tok = newToken(PLUS);
       break;
     case '{':
-      tok = newToken(LBRACE, ch);
+      tok = newToken(LBRACE);
       break;
     case '}':
-      tok = newToken(RBRACE, ch);
+      tok = newToken(RBRACE);
       break;
     case '[':
-      tok = newToken(LBRACKET, ch);
+      tok = newToken(LBRACKET);
       break;
     case ']':
-      tok = newToken(RBRACKET, ch);
+      tok = newToken(RBRACKET);
       break;
     case '"':
       tok.Type = STRING;
       tok.Literal = readString();
       break;
     case ':':
-      tok = newToken(COLON, ch);
+      tok = newToken(COLON);
       break;
     case 0:
-      tok.Literal = "";
+      // an unterminated string leaves position one past the end
       tok.Type = EOF_TOKEN;
+      tok.Literal = input.substr(min(position, input.size()), 0);
       break;
     default:
-        if (isdigit(ch)) {
+        if (hasCharClass(ch, CC_DIGIT)) {
             tok.Literal = readNumber();
-            if (tok.Literal.find('.') != std::string::npos)
+            if (tok.Literal.find('.') != string_view::npos)
             {
                 tok.Type = FLT;
             }
             else {
                 tok.Type = INT;
             }
-            return tok;
+            return finishToken(tok);
         }
-        if (isLetter(ch)) {
+        if (hasCharClass(ch, CC_ALPHA)) {
             tok.Literal = readIdentifier();
-            tok.Type = LookupType(tok.Literal);
-            if (tok.Type == IDENT)
-            {
-                tok.Type = LookupIdent(tok.Literal);
-            }
-            return tok;
+            tok.Type = LookupIdent(tok.Literal);
+            return finishToken(tok);
         }
         else {
-        tok = newToken(ILLEGAL, ch);
+        tok = newToken(ILLEGAL);
       }
       break;
     }
 
+    // readChar may refill the window and move the token under the literal
+    size_t from = tok.Literal.data() - input.data(), before = consumed;
     readChar();
-    return tok;
+    tok.Literal = input.substr(from - (consumed - before), tok.Literal.size());
+    return finishToken(tok);
   }
 
-  int GetCurrentLine() const { return line; }
+  // source offset of the literal of the last token returned
+  size_t GetTokenOffset() const { return tokenOffset; }
 
 private:
-  int position;     // current position in input (points to current char)
-  int readPosition; // current reading position in input (after current char)
+  istream *stream = nullptr; // source of further input in streaming mode
+  string window;             // streaming mode: the bytes `input` views
+  LineIndex *lines = nullptr; // streaming mode: receives the newlines read
+  size_t consumed = 0; // streaming mode: source offset of input[0]
+  size_t tokenOffset = 0;
+
+  size_t position;     // current position in input (points to current char)
+  size_t readPosition; // current reading position in input (after current char)
+  size_t tokenStart = string_view::npos; // start of the token being scanned
   char ch;          // current char under examination
-  int line;         // the current scanning line
 
   void readChar() {
-    if (readPosition >= input.size()) {
-      ch = 0;
-    } else {
+    if (readPosition < input.size()) [[likely]] {
+      ch = input[readPosition];
+    } else if (stream != nullptr && refill()) {
       ch = input[readPosition];
+    } else {
+      ch = 0;
     }
     position = readPosition;
     readPosition += 1;
   }
 
-  char peekChar() const {
-    if (readPosition >= input.size()) {
-      return 0;
-    } else {
+  char peekChar() {
+    if (readPosition < input.size()) [[likely]] {
+      return input[readPosition];
+    } else if (stream != nullptr && refill()) {
       return input[readPosition];
+    } else {
+      return 0;
     }
   }
 
-  void skipWhitespace() {
-    while (isspace(ch)) {
-      if (ch == '\n') {
-        line++;
-      }
-      readChar();
+  /*
+  * Streaming mode: drops everything before the token being scanned (or the
+  * current char between tokens), and appends the next chunk of the stream.
+  * Returns false once the stream is exhausted.
+  */
+  bool refill() {
+    if (!*stream) {
+      return false;
+    }
+    size_t keep = min(min(tokenStart, position), window.size());
+    window.erase(0, keep);
+    consumed += keep;
+    size_t kept = window.size();
+    window.resize(kept + ChunkSize);
+    stream->read(window.data() + kept, ChunkSize);
+    window.resize(kept + static_cast<size_t>(stream->gcount()));
+    input = window;
+    if (lines != nullptr) {
+      lines->append(input.substr(kept), consumed + kept);
     }
+
+    position -= keep;
+    readPosition -= keep;
+    if (tokenStart != string_view::npos) {
+      tokenStart -= keep;
+    }
+    return window.size() > kept;
+  }
+
+  Token finishToken(Token tok) {
+    tokenStart = string_view::npos;
+    tokenOffset = consumed + (tok.Literal.data() - input.data());
+    return tok;
   }
 
-  string readIdentifier() {
-    int startPos = position;
-    while (isLetter(ch)) {
+  /*
+  * Moves to the first char after the run Scan accepts, a block of chars at
+  * a time (see scanWhile). A run that reaches the end of a stream window
+  * goes on after the refill.
+  */
+  template <typename Scan> void advanceWhile() {
+    while (Scan::scalar(ch)) {
+      const char *begin = input.data();
+      readPosition =
+          scanWhile<Scan>(begin + position, begin + input.size()) - begin;
       readChar();
     }
-    return input.substr(startPos, position - startPos);
   }
 
-  string readNumber() {
-    int startPos = position;
-    short int accurance = 0;
-    while ((isdigit(ch) || ch == '.') && accurance < 2) {
-      if (ch == '.') accurance++;
+  void skipWhitespace() {
+    while (hasCharClass(ch, CC_SPACE)) {
+      const char *begin = input.data();
+      readPosition =
+          scanWhile<SpaceScan>(begin + position, begin + input.size()) - begin;
       readChar();
     }
-    return input.substr(startPos, position - startPos);
   }
 
-  string readString() {
-    int startPos = position + 1;
+  // readChar may refill the window and move the token, so the scanners
+  // below slice from tokenStart rather than a saved position
+  string_view readIdentifier() {
+    advanceWhile<IdentScan>();
+    return input.substr(tokenStart, position - tokenStart);
+  }
+
+  // digits with up to two dots; the second dot ends the literal
+  string_view readNumber() {
+    short int accurance = 0;
     while (true) {
+      advanceWhile<DigitScan>();
+      if (ch != '.') break;
       readChar();
-      if (ch == '"' || ch == 0) {
-        break;
-      }
+      if (++accurance == 2) break;
     }
-    return input.substr(startPos, position - startPos);
+    return input.substr(tokenStart, position - tokenStart);
   }
 
-  Token newToken(TokenType tokenType, char ch) {
-    return Token{tokenType, string(1, ch)};
+  string_view readString() {
+    readChar(); // opening quote
+    advanceWhile<StringScan>();
+    return input.substr(tokenStart + 1, position - tokenStart - 1);
   }
 
-  static bool isLetter(char ch) {
-    return isalpha(ch) || ch == '_' || ch == '$' || ch == '0' || ch == '1' || ch == '2' || ch == '3' || ch == '4' || ch == '5' || ch == '6' || ch == '7' || ch == '8' || ch == '9';
+  // the token ends at the current char and is `length` chars long
+  Token newToken(TokenType tokenType, size_t length = 1) {
+    return Token{tokenType, input.substr(position + 1 - length, length)};
   }
 };
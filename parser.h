@@ -1,17 +1,21 @@
 #pragma once
+#include <algorithm>
+#include <charconv>
+#include <array>
+#include <cstdint>
 #include <cstdio>
 #include <memory>
-#include <unordered_map>
 #include <utility>
 #include <vector>
 #define PARSER_H
 #include "ast.h"
 #include "lexer.h"
+#include "src/Parallel.h"
+#include "src/TokenStream.h"
 #include <format>
-#include <functional>
-using prefixParseFn = std::function<std::unique_ptr<Expression>()>;
-using infixParseFn =
-std::function<std::unique_ptr<Expression>(std::unique_ptr<Expression>)>;
+class Parser;
+using prefixParseFn = Expression* (Parser::*)();
+using infixParseFn = Expression* (Parser::*)(Expression*);
 
 enum class Precedence {
 	LOWEST = 0,
@@ -24,117 +28,341 @@ enum class Precedence {
 	INDEX = 7,
 };
 
-unordered_map<TokenType, Precedence> precedences = {
-	{EQ, Precedence::EQUALS},          {NOT_EQ, Precedence::EQUALS},
-	{LOGICAL_AND, Precedence::EQUALS}, {LOGICAL_OR, Precedence::EQUALS},
-	{LT, Precedence::LESSGREATER},     {GT, Precedence::LESSGREATER},
-	{GT_EQ, Precedence::LESSGREATER},  {LT_EQ, Precedence::LESSGREATER},
-	{PLUS, Precedence::SUM},           {MINUS, Precedence::SUM},
-	{SLASH, Precedence::PRODUCT},      {ASTERISK, Precedence::PRODUCT},
-	{MODULO, Precedence::PRODUCT},     {RSHIFT, Precedence::PRODUCT},
-	{LSHIFT, Precedence::PRODUCT},     {LPAREN, Precedence::CALL},
-	{LBRACKET, Precedence::INDEX} };
+/*
+* what an expression token does in the pratt loop: the function parsing
+* it in prefix position, the one parsing it as an operator and how
+* tightly that operator binds
+*/
+struct ParseRule {
+	prefixParseFn prefix = nullptr;
+	infixParseFn infix = nullptr;
+	Precedence precedence = Precedence::LOWEST;
+};
 
 class Parser {
 public:
-	Parser(const std::string& input) {
-		lexer = make_unique<Lexer>(input);
-		errors = vector<string>();
+	/*
+	* input must outlive the parser and the AST, tokens and
+	* nodes keep views into it
+	*/
+	Parser(std::string_view input) : tokens(std::make_shared<TokenStream>(input)) {}
+	Parser(std::istream& stream) : tokens(std::make_shared<TokenStream>(stream)) {}
+	/*
+	* parses an already tokenized program, the stream is read-only and
+	* may be shared with other parsers
+	*/
+	Parser(std::shared_ptr<const TokenStream> tokens) : tokens(std::move(tokens)) {}
+	/*
+	* the nodes are allocated in the arena of the returned program.
+	* With threads != 1 (0: one per core) top-level function definitions
+	* of large programs are parsed concurrently first, see parseFunctions;
+	* the program is the same as with one thread
+	*/
+	std::shared_ptr<Program> ParserProgram(unsigned threads = 1) {
+		auto program = std::make_shared<Program>(tokens);
+		auto piece = program->pieces.front().get();
+		arena = &piece->arena;
+		threads = resolveThreads(threads);
+		auto functions = vector<ParsedFunction>();
+		if (threads > 1 && tokens->size() >= MinParallelTokens) {
+			functions = parseFunctions(threads);
+		}
+		size_t next = 0; // the first function not behind pos
+		while (tokens->kind(pos) != EOF_TOKEN) {
+			while (next < functions.size() && functions[next].start < pos) {
+				next++;
+			}
+			auto unit = TopLevel{ nullptr, piece, tokenIndex(pos) };
+			peeked = pos;
+			if (next < functions.size() && functions[next].start == pos && functions[next].complete) {
+				// parsed ahead: the same tokens give the same tree
+				auto& function = functions[next++];
+				unit.statement = function.statement;
+				errors_.insert(errors_.end(), function.errors.begin(), function.errors.end());
+				pos = function.end;
+				peeked = function.peek;
+			}
+			else {
+				unit.statement = parseStatement();
+			}
+			unit.last = tokenIndex(pos);
+			unit.peek = tokenIndex(std::max(peeked, pos));
+			addTopLevel(*program, unit);
+			nextToken();
+		}
+		auto end = tokenIndex(pos);
+		addTopLevel(*program, TopLevel{ nullptr, piece, end, end, end });
+		program->Length = static_cast<uint32_t>(std::max<size_t>(tokens->source().size(), tokens->offset(end)));
+		program->pieceUnits = { static_cast<uint32_t>(program->TopLevels.size()) };
+		arena = nullptr;
+		return program;
+	}
 
-		infixParseFns = std::map<TokenType, infixParseFn>();
-		registerInfix(PLUS, std::bind(&Parser::parseInfixExpression, this,
-			std::placeholders::_1));
-		registerInfix(MINUS, std::bind(&Parser::parseInfixExpression, this,
-			std::placeholders::_1));
-		registerInfix(MODULO, std::bind(&Parser::parseInfixExpression, this,
-			std::placeholders::_1));
-		registerInfix(ASTERISK, std::bind(&Parser::parseInfixExpression, this,
-			std::placeholders::_1));
-		registerInfix(RSHIFT, std::bind(&Parser::parseInfixExpression, this,
-			std::placeholders::_1));
-		registerInfix(LSHIFT, std::bind(&Parser::parseInfixExpression, this,
-			std::placeholders::_1));
-		registerInfix(EQ, std::bind(&Parser::parseInfixExpression, this,
-			std::placeholders::_1));
-		registerInfix(NOT_EQ, std::bind(&Parser::parseInfixExpression, this,
-			std::placeholders::_1));
-		registerInfix(LOGICAL_AND, std::bind(&Parser::parseInfixExpression, this,
-			std::placeholders::_1));
-		registerInfix(LOGICAL_OR, std::bind(&Parser::parseInfixExpression, this,
-			std::placeholders::_1));
-		registerInfix(LT, std::bind(&Parser::parseInfixExpression, this,
-			std::placeholders::_1));
-		registerInfix(LT_EQ, std::bind(&Parser::parseInfixExpression, this,
-			std::placeholders::_1));
-		registerInfix(GT, std::bind(&Parser::parseInfixExpression, this,
-			std::placeholders::_1));
-		registerInfix(GT_EQ, std::bind(&Parser::parseInfixExpression, this,
-			std::placeholders::_1));
-		registerInfix(LPAREN, std::bind(&Parser::parseCallExpression, this,
-			std::placeholders::_1));
-		registerInfix(LBRACKET, std::bind(&Parser::parseIndexExpression, this,
-			std::placeholders::_1));
+	/*
+	* Incremental parse: the program `previous` becomes after `removed`
+	* bytes of its text at `offset` are replaced by `inserted`, the same
+	* program a full parse of the edited text gives.
+	*
+	* Only the top-level statements the edit can change are lexed and
+	* parsed again, from a copy of their text with the edit applied; all
+	* other statement subtrees, with the text and arena they live in, are
+	* shared with `previous` (so the input the first version was parsed
+	* from must outlive every later one). A statement is kept if neither
+	* its slot nor anything its parse looked at (TopLevel::peek, plus one
+	* character of lexer lookahead) reaches the edit. The edited region is
+	* parsed on its own until one of its statements ends where an old
+	* statement after the edit starts, without having looked past the
+	* region text: from there on the tokens, and so the parse, are the old
+	* ones shifted. If that never happens (an unclosed brace or string) the
+	* region grows until it reaches the end of the program.
+	*
+	* Returns null for programs parsed from a stream, whose text is not kept.
+	*/
+	static std::shared_ptr<Program> Reparse(const Program& previous, size_t offset, size_t removed, std::string_view inserted) {
+		auto& units = previous.TopLevels;
+		if (units.empty()) {
+			return nullptr;
+		}
+		offset = std::min<size_t>(offset, previous.Length);
+		removed = std::min<size_t>(removed, previous.Length - offset);
+		auto delta = static_cast<int64_t>(inserted.size()) - static_cast<int64_t>(removed);
+		auto slotEnd = [&](size_t k) -> size_t {
+			return k + 1 < units.size() ? units[k + 1].start : previous.Length;
+		};
+		// one past the last character the lexer read for the tokens unit looked at
+		auto reach = [](const TopLevel& unit) -> size_t {
+			auto& tokens = *unit.piece->tokens;
+			return unit.start + (tokens.offset(unit.peek) - unit.textStart) + tokens.length(unit.peek) + 1;
+		};
 
-		prefixParseFns = std::map<TokenType, prefixParseFn>();
-		registerPrefix(LPAREN, std::bind(&Parser::parseGroupedExpression, this));
-		registerPrefix(IDENT, std::bind(&Parser::parseIdentifier, this));
-		registerPrefix(INT, std::bind(&Parser::parseIntegerLiteral, this));
-		registerPrefix(FLT, std::bind(&Parser::parseFloatLiteral, this));
-		registerPrefix(BANG, std::bind(&Parser::parsePrefixExpression, this));
-		registerPrefix(MINUS, std::bind(&Parser::parsePrefixExpression, this));
-		registerPrefix(TRUE, std::bind(&Parser::parseBoolean, this));
-		registerPrefix(FALSE, std::bind(&Parser::parseBoolean, this));
-		registerPrefix(IF, std::bind(&Parser::parseIfExpression, this));
-		registerPrefix(WHILE, std::bind(&Parser::parseWhileLoop, this));
-		registerPrefix(STRING, std::bind(&Parser::parseStringLiteral, this));
-		registerPrefix(LBRACKET, std::bind(&Parser::parseArrayLiteral, this));
-		registerPrefix(LBRACE, std::bind(&Parser::parseHashLiteral, this));
+		// [0, a) are kept: the slot of a holds the edit, or the edit is at
+		// the start of the next slot (and changes the blanks slot a ends
+		// with), or a looked at it
+		size_t a = std::max<size_t>(units.lowerBound(offset), 1) - 1;
+		while (a > 0 && reach(units[a - 1]) > offset) {
+			a--;
+		}
+		// the region ends at the start of b, past the edit
+		size_t b = std::max(units.lowerBound(offset + removed), a + 1);
+		b = std::min(units.size(), b + ReparseMargin);
 
-		nextToken();
-		nextToken();
+		for (;;) {
+			size_t regionStart = units[a].start;
+			size_t regionEnd = b < units.size() ? units[b].start : previous.Length;
+			std::string text;
+			text.reserve(regionEnd - regionStart + inserted.size());
+			for (size_t k = a; k < b; k++) {
+				auto unit = units[k];
+				auto source = unit.piece->tokens->source();
+				auto length = slotEnd(k) - unit.start;
+				if (unit.textStart + length > source.size()) {
+					return nullptr;
+				}
+				text.append(source.substr(unit.textStart, length));
+			}
+			text.replace(offset - regionStart, removed, inserted);
 
-	}
-	std::shared_ptr<Program> ParserProgram() {
-		auto program = std::make_shared<Program>();
-		while (curToken.Type.compare(EOF_TOKEN) != 0) {
-			auto statement = parseStatement();
-			if (statement != nullptr) {
-				program->Statements.push_back(std::move(statement));
+			auto tokens = std::make_shared<const TokenStream>(std::move(text));
+			auto program = Parser(tokens).ParserProgram();
+			auto fresh = vector<TopLevel>();
+			size_t resume = units.size(); // the first old statement after the region
+			for (auto unit : program->TopLevels) {
+				unit.start += static_cast<uint32_t>(regionStart);
+				fresh.push_back(unit);
 			}
-			nextToken();
+			if (b < units.size()) {
+				for (size_t u = 0; u + 1 < fresh.size(); u++) {
+					auto peek = fresh[u].peek;
+					if (peek + 1 >= tokens->size() || tokens->offset(peek) + tokens->length(peek) + 1 > tokens->source().size()) {
+						break;
+					}
+					size_t next = regionStart + tokens->start(fresh[u].last + 1);
+					if (next < offset + inserted.size()) {
+						continue;
+					}
+					auto old = static_cast<size_t>(static_cast<int64_t>(next) - delta);
+					size_t j = units.lowerBound(old);
+					if (j <= b && units[j].start == old) {
+						resume = j;
+						fresh.resize(u + 1);
+						break;
+					}
+				}
+				if (resume == units.size()) {
+					// no way back to the old statements yet, take in more of them
+					b = std::min(units.size(), b + std::max(b - a, ReparseMargin));
+					continue;
+				}
+			}
+			program->TopLevels = units.replace(a, resume, fresh, delta);
+			program->Length = static_cast<uint32_t>(previous.Length + delta);
+
+			// drop the pieces no statement comes from any more
+			auto counts = previous.pieceUnits;
+			for (size_t k = a, p = 0; k < resume; k++) {
+				auto piece = units[k].piece;
+				if (previous.pieces[p].get() != piece) {
+					p = std::find_if(previous.pieces.begin(), previous.pieces.end(),
+						[&](auto& owned) { return owned.get() == piece; }) - previous.pieces.begin();
+				}
+				counts[p]--;
+			}
+			program->pieceUnits = { static_cast<uint32_t>(fresh.size()) };
+			for (size_t p = 0; p < previous.pieces.size(); p++) {
+				if (counts[p] != 0) {
+					program->pieces.push_back(previous.pieces[p]);
+					program->pieceUnits.push_back(counts[p]);
+				}
+			}
+			return program;
 		}
-		return program;
 	}
 
+	/*
+	* the syntax errors of the programs parsed so far; where they are, the
+	* program has null nodes
+	*/
+	const vector<string>& errors() const { return errors_; }
+
+	// programs with fewer tokens are parsed on one thread
+	static constexpr size_t MinParallelTokens = 1 << 16;
+	// old statements past the edit a reparse starts with
+	static constexpr size_t ReparseMargin = 2;
+
 private:
+	/*
+	* a top-level function definition parsed ahead of the main pass
+	*/
+	struct ParsedFunction {
+		size_t start = 0; // the return type token
+		size_t end = 0; // the matching '}' of the body
+		size_t peek = 0; // the last token the parse looked at
+		Statement* statement = nullptr;
+		bool complete = false; // the parse stopped at end
+		vector<string> errors;
+	};
+
+	/*
+	* Finds the top-level function definitions (a type, a name and '(' at
+	* brace depth 0) and the '}' closing each body by brace matching on the
+	* token kinds, then parses them on `threads` threads, each into its own
+	* arena. Parsing only depends on the tokens from the start position on,
+	* so a function whose parse stops at its matching brace is exactly what
+	* the serial pass would build there; the main pass takes such results
+	* when it reaches their start and parses everything else itself.
+	*/
+	vector<ParsedFunction> parseFunctions(unsigned threads) {
+		auto functions = vector<ParsedFunction>();
+		int depth = 0;
+		for (size_t i = 0; tokens->kind(i) != EOF_TOKEN; i++) {
+			auto kind = tokens->kind(i);
+			if (kind == LBRACE) {
+				depth++;
+			}
+			else if (kind == RBRACE) {
+				depth = std::max(depth - 1, 0);
+			}
+			else if (depth == 0 && IsTypeToken(kind) && tokens->kind(i + 1) == IDENT && tokens->kind(i + 2) == LPAREN) {
+				size_t close = i + 3;
+				while (tokens->kind(close) != RPAREN && tokens->kind(close) != EOF_TOKEN) {
+					close++;
+				}
+				if (tokens->kind(close + 1) != LBRACE) {
+					continue;
+				}
+				size_t end = close + 1;
+				for (int braces = 0; tokens->kind(end) != EOF_TOKEN; end++) {
+					braces += tokens->kind(end) == LBRACE ? 1 : tokens->kind(end) == RBRACE ? -1 : 0;
+					if (braces == 0) {
+						break;
+					}
+				}
+				if (tokens->kind(end) == EOF_TOKEN) {
+					break;
+				}
+				functions.push_back(ParsedFunction{ i, end });
+				i = end;
+			}
+		}
+
+		auto arenas = vector<Arena>(threads);
+		auto parsers = vector<std::unique_ptr<Parser>>();
+		for (unsigned w = 0; w < threads; w++) {
+			parsers.push_back(std::make_unique<Parser>(tokens));
+			parsers.back()->arena = &arenas[w];
+		}
+		parallelFor(functions.size(), threads, [&](unsigned worker, size_t i) {
+			auto& parser = *parsers[worker];
+			auto& function = functions[i];
+			parser.pos = parser.peeked = function.start;
+			function.statement = parser.parseStatement();
+			function.complete = parser.pos == function.end;
+			function.peek = std::max(parser.peeked, parser.pos);
+			function.errors = std::move(parser.errors_);
+			parser.errors_.clear();
+		});
+		for (auto& a : arenas) {
+			arena->adopt(a);
+		}
+		return functions;
+	}
+	/*
+	* appends a top-level step; slots start at their first token, the
+	* first one at the start of the text
+	*/
+	void addTopLevel(Program& program, TopLevel unit) const {
+		unit.start = unit.textStart = program.TopLevels.empty() ? 0 : tokens->start(unit.first);
+		program.TopLevels.push_back(unit);
+	}
+	uint32_t tokenIndex(size_t i) const {
+		return static_cast<uint32_t>(std::min(i, tokens->size() - 1));
+	}
 	void nextToken(void) {
-		curToken = peekToken;
-		peekToken = lexer->NextToken();
+		pos++;
+	}
+	Token curToken() const { return tokens->token(pos); }
+	// the name token i spells; tokens other than IDENT are only named here
+	Symbol symbolAt(size_t i) const {
+		auto symbol = tokens->symbol(i);
+		return symbol != SymbolTable::None ? symbol : SymbolTable::global().intern(tokens->text(i));
+	}
+	Token peekToken() {
+		peeked = std::max(peeked, pos + 1);
+		return tokens->token(pos + 1);
+	}
+	// the kind of the next token; all lookahead goes through here or peekToken
+	TokenType peekKind() {
+		peeked = std::max(peeked, pos + 1);
+		return tokens->kind(pos + 1);
 	}
-	std::unique_ptr<Statement> parseStatement() {
-		if (LookupType(curToken.Type).compare(IDENT)!=0)
+	Statement* parseStatement() {
+		if (IsTypeToken(tokens->kind(pos)))
 		{
 			return parseFunctionLiteral();
 		}
-		if (curToken.Type.compare(LET) == 0 || curToken.Type.compare(MUT)==0) {
+		if (tokens->kind(pos) == LET || tokens->kind(pos) == MUT) {
 			return parseLetStatement();
 		}
-		else if (curToken.Type.compare(RETURN) == 0) {
+		else if (tokens->kind(pos) == LBRACE) {
+			// a block of its own; hash literals only start expressions
+			return parseBlockStatement();
+		}
+		else if (tokens->kind(pos) == RETURN) {
 			return parseReturnStatment();
 		}
 		return parseExpressionStatement();
 	}
-	std::unique_ptr<Identifier> parseIdentifier() {
-		auto ident = std::make_unique<Identifier>(curToken, curToken.Literal);
-		return std::move(ident);
+	Expression* parseIdentifier() {
+		auto ident = arena->make<Identifier>(curToken(), symbolAt(pos));
+		return ident;
 	}
 
-	std::unique_ptr<LetStatement> parseLetStatement() {
-		auto statement = std::make_unique<LetStatement>(curToken);
+	LetStatement* parseLetStatement() {
+		auto statement = arena->make<LetStatement>(curToken());
 		if (!expectPeek(IDENT)) {
 			return nullptr;
 		}
-		statement->Name = make_unique<Identifier>(curToken, curToken.Literal);
+		statement->Name = arena->make<Identifier>(curToken(), symbolAt(pos));
 		if (!expectPeek(ASSIGN)) {
 			return nullptr;
 		}
@@ -143,20 +371,20 @@ private:
 		if (peekTokenIs(SEMICOLON)) {
 			nextToken();
 		}
-		return std::move(statement);
+		return statement;
 	}
 
-	std::unique_ptr<ReturnStatement> parseReturnStatment() {
-		auto stmt = std::make_unique<ReturnStatement>(curToken);
+	ReturnStatement* parseReturnStatment() {
+		auto stmt = arena->make<ReturnStatement>(curToken());
 		nextToken();
 		stmt->ReturnValue = parseExpression(Precedence::LOWEST);
 		if (peekTokenIs(SEMICOLON)) {
 			nextToken();
 		}
-		return std::move(stmt);
+		return stmt;
 	}
-	std::unique_ptr<ExpressionStatement> parseExpressionStatement() {
-		auto stmt = std::make_unique<ExpressionStatement>(curToken);
+	ExpressionStatement* parseExpressionStatement() {
+		auto stmt = arena->make<ExpressionStatement>(curToken());
 
 		stmt->Expression = parseExpression(Precedence::LOWEST);
 
@@ -164,81 +392,75 @@ private:
 			nextToken();
 		}
 
-		return std::move(stmt);
+		return stmt;
 	}
-	std::unique_ptr<Expression> parseExpression(Precedence p) {
-		auto prefix = prefixParseFns.find(curToken.Type);
-		if (prefix->second == nullptr) {
-			noPrefixParseFnError(curToken.Type);
+	Expression* parseExpression(Precedence p) {
+		auto prefix = parseRule(tokens->kind(pos)).prefix;
+		if (prefix == nullptr) {
+			noPrefixParseFnError(tokens->kind(pos));
 			return nullptr;
 		}
-		auto leftExp = prefix->second();
+		auto leftExp = (this->*prefix)();
 		while (!(peekTokenIs(SEMICOLON)) && p < peekPrecedence()) {
-			auto infix = infixParseFns.find(peekToken.Type);
-			if (infix->second == nullptr) {
-				return std::move(leftExp);
+			auto infix = parseRule(peekKind()).infix;
+			if (infix == nullptr) {
+				return leftExp;
 			}
 			nextToken();
-			leftExp = infix->second(std::move(leftExp));
+			leftExp = (this->*infix)(leftExp);
 		}
-		return std::move(leftExp);
+		return leftExp;
 	}
-	std::unique_ptr<IntegerLiteral> parseIntegerLiteral() {
-		auto lit = std::make_unique<IntegerLiteral>(curToken);
-		try {
-			auto value = std::stoi(curToken.Literal);
-			lit->Value = value;
-		}
-		catch (std::invalid_argument const& ex) {
+	Expression* parseIntegerLiteral() {
+		auto lit = arena->make<IntegerLiteral>(curToken());
+		if (!parseNumber(curToken().Literal, lit->Value)) {
 			auto msg = std::format("at line {} could not parse {} as integer",
-				lexer->GetCurrentLine(), curToken.Literal);
+				tokens->line(pos), curToken().Literal);
+			errors_.push_back(msg);
 			return nullptr;
 		}
-		return std::move(lit);
+		return lit;
 	}
-	std::unique_ptr<FloatLiteral> parseFloatLiteral() {
-		auto lit = std::make_unique <FloatLiteral> (curToken);
-		try {
-			auto value = std::stof(curToken.Literal);
-			lit->Value = value;
-		}
-		catch (std::invalid_argument const& ex) {
-			auto msg = std::format("at line {} could not parse {} as integer",
-				lexer->GetCurrentLine(), curToken.Literal);
+	Expression* parseFloatLiteral() {
+		auto lit = arena->make<FloatLiteral>(curToken());
+		if (!parseNumber(curToken().Literal, lit->Value)) {
+			auto msg = std::format("at line {} could not parse {} as float",
+				tokens->line(pos), curToken().Literal);
+			errors_.push_back(msg);
 			return nullptr;
 		}
-		return std::move(lit);
+		return lit;
 	}
-	std::unique_ptr<Expression> parseBoolean() {
-		return std::make_unique<Boolean>(curToken, curTokenIs(TRUE));
+	Expression* parseBoolean() {
+		return arena->make<Boolean>(curToken(), curTokenIs(TRUE));
 	}
 
-	std::unique_ptr<Expression> parsePrefixExpression() {
-		auto expr = std::make_unique<PrefixExpression>(curToken, curToken.Literal);
+	Expression* parsePrefixExpression() {
+		auto expr = arena->make<PrefixExpression>(curToken(), curToken().Literal);
 		nextToken();
 		expr->Right = parseExpression(Precedence::LOWEST);
-		return std::move(expr);
+		return expr;
 	}
 
-	std::unique_ptr<Expression>
-		parseInfixExpression(std::unique_ptr<Expression> left) {
-		auto expr = std::make_unique<InfixExpression>(curToken, curToken.Literal,
-			std::move(left),nullptr);
+	Expression*
+		parseInfixExpression(Expression* left) {
+		auto expr = arena->make<InfixExpression>(curToken(), curToken().Literal,
+			left,nullptr);
 		auto precedence = curPrecedence();
 		nextToken();
 		expr->Right = parseExpression(precedence);
-		return std::move(expr);
+		return expr;
 	}
-	std::unique_ptr<Expression> parseGroupedExpression() {
+	Expression* parseGroupedExpression() {
 		nextToken();
 		auto exp = parseExpression(Precedence::LOWEST);
-		if (!expectPeek(LPAREN)) {
+		if (!expectPeek(RPAREN)) {
 			return nullptr;
 		}
-		return std::move(exp);
+		return exp;
 	}
-	std::unique_ptr<Expression> parseIfExpression() {
-		auto expr = std::make_unique<IfExpression>(curToken);
+	Expression* parseIfExpression() {
+		auto expr = arena->make<IfExpression>(curToken());
 		if (!expectPeek(LPAREN)) {
 			return nullptr;
 		}
@@ -258,7 +480,7 @@ private:
 			}
 			expr->Alternative = parseBlockStatement();
 		}
-		return std::move(expr);
+		return expr;
 	}
 	/*
 	* syntax:
@@ -268,39 +490,40 @@ private:
 	* example:
 	* i32 sum(i32 x,i32 y)
 	*/
-	std::unique_ptr<Statement> parseFunctionLiteral() {
-		auto lit = std::make_unique<FunctionLiteral>(curToken);
+	Statement* parseFunctionLiteral() {
+		auto lit = arena->make<FunctionLiteral>(curToken());
 		if (!expectPeek(IDENT))
 		{
 			return nullptr;
 		}
-		lit->ident = curToken;
+		lit->ident = curToken();
+		lit->Name = symbolAt(pos);
 		if (!expectPeek(LPAREN)) {
 			return nullptr;
 		}
-		lit->Parameters = parseFunctionParameters();
+		lit->Parameters = arena->copy(parseFunctionParameters());
 		if (!expectPeek(LBRACE)) {
 			return nullptr;
 		}
 		lit->Body = parseBlockStatement();
-		return std::move(lit);
+		return lit;
 	}
 	// (i32 age,i1 alive)
-	std::vector<std::unique_ptr<Identifier>> parseFunctionParameters() {
-		auto identifiers = vector<std::unique_ptr<Identifier>>();
+	std::vector<Identifier*> parseFunctionParameters() {
+		auto identifiers = vector<Identifier*>();
 		if (peekTokenIs(RPAREN)) {
 			nextToken();
 			return identifiers;
 		}
 		nextToken(); // type example : i32
-		auto ident = std::make_unique<Identifier>(peekToken, peekToken.Literal,curToken.Literal);
-		identifiers.push_back(std::move(ident));
+		auto ident = arena->make<Identifier>(peekToken(), symbolAt(pos + 1), tokens->kind(pos));
+		identifiers.push_back(ident);
 		nextToken(); // curtoken -> identifier
 		while (peekTokenIs(COMMA)) {
 			nextToken(); // -> comma
 			nextToken(); // -> type i32,i16 etc
-			auto ident = std::make_unique<Identifier>(peekToken, peekToken.Literal,curToken.Literal);
-			identifiers.push_back(std::move(ident));
+			auto ident = arena->make<Identifier>(peekToken(), symbolAt(pos + 1), tokens->kind(pos));
+			identifiers.push_back(ident);
 			nextToken();
 		}
 		if (!expectPeek(RPAREN)) {
@@ -309,14 +532,14 @@ private:
 		}
 		return identifiers;
 	}
-	std::unique_ptr<Expression>
-		parseCallExpression(std::unique_ptr<Expression> function) {
-		auto expr = std::make_unique<CallExpression>(curToken, std::move(function));
-		expr->Arguments = parseExpressionList(RPAREN);
-		return std::move(expr);
+	Expression*
+		parseCallExpression(Expression* function) {
+		auto expr = arena->make<CallExpression>(curToken(), function);
+		expr->Arguments = arena->copy(parseExpressionList(RPAREN));
+		return expr;
 	}
-	vector<std::unique_ptr<Expression>> parseCallArguments() {
-		auto args = vector<std::unique_ptr<Expression>>();
+	vector<Expression*> parseCallArguments() {
+		auto args = vector<Expression*>();
 		if (peekTokenIs(LPAREN)) {
 			nextToken();
 			return args;
@@ -339,8 +562,8 @@ private:
 		return args;
 	}
 
-	vector<std::unique_ptr<Expression>> parseExpressionList(TokenType end) {
-		auto list = vector<std::unique_ptr<Expression>>();
+	vector<Expression*> parseExpressionList(TokenType end) {
+		auto list = vector<Expression*>();
 		if (peekTokenIs(end)) {
 			nextToken();
 			return list;
@@ -358,8 +581,8 @@ private:
 		}
 		return list;
 	}
-	std::unique_ptr<Expression> parseWhileLoop() {
-		auto expr = make_unique<WhileExpression>(curToken);
+	Expression* parseWhileLoop() {
+		auto expr = arena->make<WhileExpression>(curToken());
 		if (!expectPeek(LPAREN)) {
 			return nullptr;
 		}
@@ -372,92 +595,139 @@ private:
 			return nullptr;
 		}
 		expr->Body = parseBlockStatement();
-		return std::move(expr);
+		return expr;
 	}
-	std::unique_ptr<BlockStatement> parseBlockStatement() {
-		auto block = std::make_unique<BlockStatement>(curToken);
-		block->Statements = vector<unique_ptr<Statement>>();
+	BlockStatement* parseBlockStatement() {
+		auto block = arena->make<BlockStatement>(curToken());
+		auto statements = vector<Statement*>();
+		nextToken();
 		while (!curTokenIs(RBRACE) && !curTokenIs(EOF_TOKEN)) {
 			auto stmt = parseStatement();
 			if (stmt != nullptr) {
-				block->Statements.push_back(std::move(stmt));
+				statements.push_back(stmt);
 			}
 			nextToken();
 		}
-		return std::move(block);
+		block->Statements = arena->copy(statements);
+		return block;
 	}
-	std::unique_ptr<Expression> parseStringLiteral() {
-		return std::make_unique<StringLiteral>(curToken, curToken.Literal);
+	Expression* parseStringLiteral() {
+		return arena->make<StringLiteral>(curToken(), curToken().Literal);
 	}
-	std::unique_ptr<Expression> parseArrayLiteral() {
-		auto array = std::make_unique<ArrayLiteral>(curToken);
-		array->Elements = parseExpressionList(RBRACKET);
-		return std::move(array);
+	Expression* parseArrayLiteral() {
+		auto array = arena->make<ArrayLiteral>(curToken());
+		array->Elements = arena->copy(parseExpressionList(RBRACKET));
+		return array;
 	}
-	std::unique_ptr<Expression>
-		parseIndexExpression(std::unique_ptr<Expression> left) {
-		auto expr = std::make_unique<IndexExpression>(curToken, std::move(left));
+	Expression*
+		parseIndexExpression(Expression* left) {
+		auto expr = arena->make<IndexExpression>(curToken(), left);
 		nextToken();
 		expr->Index = parseExpression(Precedence::LOWEST);
-		if (expectPeek(RBRACKET)) {
+		if (!expectPeek(RBRACKET)) {
 			return nullptr;
 		}
-		return std::move(expr);
+		return expr;
 	}
-	std::unique_ptr<Expression> parseHashLiteral() {
-		auto hash = std::make_unique<HashLiteral>(curToken);
-		hash->Pairs =
-			map<std::unique_ptr<Expression>, std::unique_ptr<Expression>>();
-		while (peekTokenIs(RBRACE)) {
+	Expression* parseHashLiteral() {
+		auto hash = arena->make<HashLiteral>(curToken());
+		auto pairs = vector<std::pair<Expression*, Expression*>>();
+		while (!peekTokenIs(RBRACE)) {
 			nextToken();
 			auto key = parseExpression(Precedence::LOWEST);
-			if (expectPeek(COLON)) {
+			if (!expectPeek(COLON)) {
 				return nullptr;
 			}
 			nextToken();
 			auto value = parseExpression(Precedence::LOWEST);
-			hash->Pairs[std::move(key)] = std::move(value);
-			if (peekTokenIs(RBRACE) && !expectPeek(COMMA)) {
+			pairs.emplace_back(key, value);
+			if (!peekTokenIs(RBRACE) && !expectPeek(COMMA)) {
 				return nullptr;
 			}
 		}
 		if (!expectPeek(RBRACE)) {
 			return nullptr;
 		}
-		return std::move(hash);
+		hash->Pairs = arena->copy(pairs);
+		return hash;
 	}
 
-	Precedence peekPrecedence() const {
-		unordered_map<TokenType, Precedence>::const_iterator found =
-			precedences.find(peekToken.Type);
-		if (found == precedences.end()) {
-			return Precedence::LOWEST;
-		}
-		return found->second;
+	/*
+	* converts a numeric literal without throwing; the whole literal
+	* must be consumed, "1.2." is rejected instead of silently truncated
+	*/
+	template <typename T>
+	static bool parseNumber(std::string_view literal, T& value) {
+		auto [ptr, ec] = std::from_chars(literal.data(), literal.data() + literal.size(), value);
+		return ec == std::errc() && ptr == literal.data() + literal.size();
+	}
+
+	/*
+	* the pratt table, indexed by token kind. Built at compile time, so
+	* dispatch is an array load and a direct member function call
+	*/
+	static const ParseRule& parseRule(TokenType t) {
+		static constexpr auto rules = [] {
+			std::array<ParseRule, TOKEN_TYPE_COUNT> r{};
+			auto infix = [&](TokenType t, Precedence p, infixParseFn fn = &Parser::parseInfixExpression) {
+				r[t].infix = fn;
+				r[t].precedence = p;
+			};
+			infix(EQ, Precedence::EQUALS);
+			infix(NOT_EQ, Precedence::EQUALS);
+			infix(LOGICAL_AND, Precedence::EQUALS);
+			infix(LOGICAL_OR, Precedence::EQUALS);
+			infix(LT, Precedence::LESSGREATER);
+			infix(GT, Precedence::LESSGREATER);
+			infix(LT_EQ, Precedence::LESSGREATER);
+			infix(GT_EQ, Precedence::LESSGREATER);
+			infix(PLUS, Precedence::SUM);
+			infix(MINUS, Precedence::SUM);
+			infix(SLASH, Precedence::PRODUCT);
+			infix(ASTERISK, Precedence::PRODUCT);
+			infix(MODULO, Precedence::PRODUCT);
+			infix(RSHIFT, Precedence::PRODUCT);
+			infix(LSHIFT, Precedence::PRODUCT);
+			infix(LPAREN, Precedence::CALL, &Parser::parseCallExpression);
+			infix(LBRACKET, Precedence::INDEX, &Parser::parseIndexExpression);
+
+			r[LPAREN].prefix = &Parser::parseGroupedExpression;
+			r[IDENT].prefix = &Parser::parseIdentifier;
+			r[INT].prefix = &Parser::parseIntegerLiteral;
+			r[FLT].prefix = &Parser::parseFloatLiteral;
+			r[BANG].prefix = &Parser::parsePrefixExpression;
+			r[MINUS].prefix = &Parser::parsePrefixExpression;
+			r[TRUE].prefix = &Parser::parseBoolean;
+			r[FALSE].prefix = &Parser::parseBoolean;
+			r[IF].prefix = &Parser::parseIfExpression;
+			r[WHILE].prefix = &Parser::parseWhileLoop;
+			r[STRING].prefix = &Parser::parseStringLiteral;
+			r[LBRACKET].prefix = &Parser::parseArrayLiteral;
+			r[LBRACE].prefix = &Parser::parseHashLiteral;
+			return r;
+		}();
+		return rules[t];
+	}
+	Precedence peekPrecedence() {
+		return parseRule(peekKind()).precedence;
 	}
 	Precedence curPrecedence() const {
-		unordered_map<TokenType, Precedence>::const_iterator found =
-			precedences.find(curToken.Type);
-		if (found == precedences.end()) {
-			return Precedence::LOWEST;
-		}
-		return found->second;
+		return parseRule(tokens->kind(pos)).precedence;
 	}
-	void registerPrefix(TokenType t, prefixParseFn fn) { prefixParseFns[t] = fn; }
-	void registerInfix(TokenType t, infixParseFn fn) { infixParseFns[t] = fn; }
 	void peekError(TokenType t) {
 		auto msg =
 			std::format("at line {} expected next token to be {}, got {} instead",
-				lexer->GetCurrentLine(), t, peekToken.Type);
+				tokens->line(pos + 1), TokenTypeString(t), TokenTypeString(tokens->kind(pos + 1)));
+		errors_.push_back(msg);
 	}
-	void noPrefixParseFnError(const TokenType& t) {
+	void noPrefixParseFnError(TokenType t) {
 		auto msg = std::format("at line {} no prefix function found for {}",
-			lexer->GetCurrentLine(), t);
-		errors.push_back(msg);
+			tokens->line(pos), TokenTypeString(t));
+		errors_.push_back(msg);
 	}
-	bool curTokenIs(const TokenType& t) { return !(curToken.Type.compare(t)); }
-	bool peekTokenIs(const TokenType& t) { return !(peekToken.Type.compare(t)); }
-	bool expectPeek(const TokenType& t) {
+	bool curTokenIs(TokenType t) const { return tokens->kind(pos) == t; }
+	bool peekTokenIs(TokenType t) { return peekKind() == t; }
+	bool expectPeek(TokenType t) {
 		if (peekTokenIs(t)) {
 			nextToken();
 			return true;
@@ -467,10 +737,9 @@ private:
 			return false;
 		}
 	}
-	unique_ptr<Lexer> lexer;
-	Token curToken;
-	Token peekToken;
-	vector<string> errors;
-	std::map<TokenType, infixParseFn> infixParseFns;
-	std::map<TokenType, prefixParseFn> prefixParseFns;
+	std::shared_ptr<const TokenStream> tokens;
+	size_t pos = 0; // index of the current token, peek is pos + 1
+	size_t peeked = 0; // the furthest token looked at, see TopLevel::peek
+	Arena* arena = nullptr; // of the program being parsed
+	vector<string> errors_;
 };
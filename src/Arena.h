@@ -0,0 +1,105 @@
+#pragma once
+#ifndef Arena_h
+#define Arena_h
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * Arena: bump-pointer allocator for the nodes of one program.
+ *
+ * Objects are carved out of large blocks one after the other and are never
+ * freed on their own; the blocks go all at once when the arena is
+ * destroyed. Only trivially destructible types are accepted, since no
+ * destructor is ever run.
+ */
+class Arena {
+public:
+    Arena() = default;
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    /**
+     * Constructs a T in the arena.
+     */
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        static_assert(std::is_trivially_destructible_v<T>, "arena objects are never destroyed");
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    /**
+     * Copies `items` into the arena.
+     */
+    template <typename T>
+    std::span<T> copy(const std::vector<T>& items) {
+        static_assert(std::is_trivially_destructible_v<T>, "arena objects are never destroyed");
+        if (items.empty()) {
+            return {};
+        }
+        auto* data = static_cast<T*>(allocate(sizeof(T) * items.size(), alignof(T)));
+        std::uninitialized_copy(items.begin(), items.end(), data);
+        return { data, items.size() };
+    }
+
+    /**
+     * Takes over the blocks of `other` (an arena filled on another thread),
+     * which is left empty; its objects now live as long as this arena.
+     */
+    void adopt(Arena& other) {
+        for (auto& block : other.blocks_) {
+            blocks_.push_back(std::move(block));
+        }
+        used_ += other.used_;
+        other.blocks_.clear();
+        other.next_ = other.end_ = 0;
+        other.used_ = 0;
+    }
+
+    /**
+     * Bytes handed out so far.
+     */
+    size_t bytesUsed() const { return used_; }
+
+private:
+    void* allocate(size_t size, size_t align) {
+        auto p = (next_ + align - 1) & ~(uintptr_t(align) - 1);
+        if (p + size > end_) {
+            grow(size + align);
+            p = (next_ + align - 1) & ~(uintptr_t(align) - 1);
+        }
+        next_ = p + size;
+        used_ += size;
+        return reinterpret_cast<void*>(p);
+    }
+
+    /**
+     * Starts a new block of at least `size` bytes. Blocks double up to
+     * MaxBlockSize so small programs stay small.
+     */
+    void grow(size_t size) {
+        blockSize_ = std::min(blockSize_ * 2, MaxBlockSize);
+        size_t n = std::max(blockSize_, size);
+        blocks_.emplace_back(new char[n]);
+        next_ = reinterpret_cast<uintptr_t>(blocks_.back().get());
+        end_ = next_ + n;
+    }
+
+    static constexpr size_t MaxBlockSize = 1 << 20;
+
+    std::vector<std::unique_ptr<char[]>> blocks_;
+    uintptr_t next_ = 0;
+    uintptr_t end_ = 0;
+    size_t blockSize_ = 2048;
+    size_t used_ = 0;
+};
+
+#endif
@@ -0,0 +1,170 @@
+#pragma once
+#ifndef CharClass_h
+#define CharClass_h
+
+#include <array>
+#include <bit>
+#include <cstdint>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define CMINUS_SCAN_AVX2 1
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CMINUS_SCAN_SSE2 1
+#endif
+
+/**
+ * Character classes used by the lexer.
+ */
+enum CharClass : uint8_t {
+    CC_SPACE = 1,  // ' ', \t, \n, \v, \f, \r
+    CC_ALPHA = 2,  // a-z, A-Z, '_', '$'
+    CC_DIGIT = 4,  // 0-9
+    CC_IDENT = CC_ALPHA | CC_DIGIT,
+};
+
+/**
+ * Class of every byte, replaces the locale dependent isspace/isalpha/isdigit
+ * calls (which are also undefined for negative chars).
+ */
+inline constexpr std::array<uint8_t, 256> CharClassTable = [] {
+    std::array<uint8_t, 256> table{};
+    for (int c = 0; c < 256; c++) {
+        if (c == ' ' || (c >= '\t' && c <= '\r')) {
+            table[c] |= CC_SPACE;
+        }
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '$') {
+            table[c] |= CC_ALPHA;
+        }
+        if (c >= '0' && c <= '9') {
+            table[c] |= CC_DIGIT;
+        }
+    }
+    return table;
+}();
+
+inline bool hasCharClass(char ch, uint8_t cls) {
+    return (CharClassTable[static_cast<unsigned char>(ch)] & cls) != 0;
+}
+
+/**
+ * Block classifiers: each returns, per byte, 0xFF when the scan should go on
+ * and 0 where it should stop. Ranges are tested with the unsigned
+ * min(x - lo, hi - lo) == x - lo trick since SSE2/AVX2 lack unsigned compares.
+ */
+struct SpaceScan {
+    static bool scalar(char ch) { return hasCharClass(ch, CC_SPACE); }
+#ifdef CMINUS_SCAN_SSE2
+    static __m128i block(__m128i x) {
+        __m128i t = _mm_sub_epi8(x, _mm_set1_epi8('\t'));
+        return _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),
+            _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8('\r' - '\t')), t));
+    }
+#endif
+#ifdef CMINUS_SCAN_AVX2
+    static __m256i block(__m256i x) {
+        __m256i t = _mm256_sub_epi8(x, _mm256_set1_epi8('\t'));
+        return _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')),
+            _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8('\r' - '\t')), t));
+    }
+#endif
+};
+
+struct DigitScan {
+    static bool scalar(char ch) { return hasCharClass(ch, CC_DIGIT); }
+#ifdef CMINUS_SCAN_SSE2
+    static __m128i block(__m128i x) {
+        __m128i d = _mm_sub_epi8(x, _mm_set1_epi8('0'));
+        return _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+    }
+#endif
+#ifdef CMINUS_SCAN_AVX2
+    static __m256i block(__m256i x) {
+        __m256i d = _mm256_sub_epi8(x, _mm256_set1_epi8('0'));
+        return _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(9)), d);
+    }
+#endif
+};
+
+struct IdentScan {
+    static bool scalar(char ch) { return hasCharClass(ch, CC_IDENT); }
+#ifdef CMINUS_SCAN_SSE2
+    static __m128i block(__m128i x) {
+        // x | 0x20 folds upper case onto lower case
+        __m128i l = _mm_sub_epi8(_mm_or_si128(x, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+        __m128i d = _mm_sub_epi8(x, _mm_set1_epi8('0'));
+        __m128i letter = _mm_cmpeq_epi8(_mm_min_epu8(l, _mm_set1_epi8('z' - 'a')), l);
+        __m128i digit = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+        __m128i extra = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('_')),
+            _mm_cmpeq_epi8(x, _mm_set1_epi8('$')));
+        return _mm_or_si128(_mm_or_si128(letter, digit), extra);
+    }
+#endif
+#ifdef CMINUS_SCAN_AVX2
+    static __m256i block(__m256i x) {
+        __m256i l = _mm256_sub_epi8(_mm256_or_si256(x, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+        __m256i d = _mm256_sub_epi8(x, _mm256_set1_epi8('0'));
+        __m256i letter = _mm256_cmpeq_epi8(_mm256_min_epu8(l, _mm256_set1_epi8('z' - 'a')), l);
+        __m256i digit = _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(9)), d);
+        __m256i extra = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('_')),
+            _mm256_cmpeq_epi8(x, _mm256_set1_epi8('$')));
+        return _mm256_or_si256(_mm256_or_si256(letter, digit), extra);
+    }
+#endif
+};
+
+// string literal body: everything up to the closing '"' or a NUL
+struct StringScan {
+    static bool scalar(char ch) { return ch != '"' && ch != 0; }
+#ifdef CMINUS_SCAN_SSE2
+    static __m128i block(__m128i x) {
+        __m128i stop = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('"')),
+            _mm_cmpeq_epi8(x, _mm_setzero_si128()));
+        return _mm_xor_si128(stop, _mm_set1_epi8(-1));
+    }
+#endif
+#ifdef CMINUS_SCAN_AVX2
+    static __m256i block(__m256i x) {
+        __m256i stop = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('"')),
+            _mm256_cmpeq_epi8(x, _mm256_setzero_si256()));
+        return _mm256_xor_si256(stop, _mm256_set1_epi8(-1));
+    }
+#endif
+};
+
+/**
+ * Returns the first char in [p, end) the scanner stops at, or end.
+ * Classifies 32 (AVX2) or 16 (SSE2) bytes per step with unaligned loads
+ * that never cross `end`, then finishes the tail with the table.
+ */
+template <typename Scan>
+inline const char* scanWhile(const char* p, const char* end) {
+#ifdef CMINUS_SCAN_AVX2
+    while (end - p >= 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        uint32_t stop = ~static_cast<uint32_t>(_mm256_movemask_epi8(Scan::block(x)));
+        if (stop != 0) {
+            return p + std::countr_zero(stop);
+        }
+        p += 32;
+    }
+#endif
+#ifdef CMINUS_SCAN_SSE2
+    while (end - p >= 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        uint32_t stop = ~static_cast<uint32_t>(_mm_movemask_epi8(Scan::block(x))) & 0xFFFF;
+        if (stop != 0) {
+            return p + std::countr_zero(stop);
+        }
+        p += 16;
+    }
+#endif
+    while (p < end && Scan::scalar(*p)) {
+        p++;
+    }
+    return p;
+}
+
+#endif
@@ -0,0 +1,116 @@
+#pragma once
+#ifndef CompileCache_h
+#define CompileCache_h
+
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <string>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA256.h"
+#include "llvm/Support/raw_ostream.h"
+
+/**
+ * CompileCache: compiled artifacts on disk, addressed by what they were
+ * compiled from.
+ *
+ * A key is the hash of everything an artifact depends on (the source
+ * text, the compiler, the optimization level, the target, the kind of
+ * output), so an entry never goes stale: a change makes a new key.
+ * Entries are files named by their key, spread over subdirectories by
+ * its first two digits. They are written to a temporary file renamed
+ * into place, so compilers sharing the cache never read half an entry.
+ *
+ * It is the JIT's ObjectCache too: a module whose identifier is a key
+ * has its object kept under that key, and found there the next time.
+ */
+class CompileCache : public llvm::ObjectCache {
+public:
+    explicit CompileCache(std::string directory) : directory_(std::move(directory)) {}
+
+    /**
+     * The key of an artifact made from all of `parts`: their SHA-256, in
+     * hex.
+     */
+    static std::string key(std::initializer_list<llvm::StringRef> parts) {
+        llvm::SHA256 hash;
+        for (auto part : parts) {
+            // sized, so that ("ab", "c") and ("a", "bc") differ
+            uint64_t size = part.size();
+            hash.update(llvm::StringRef(reinterpret_cast<const char*>(&size), sizeof(size)));
+            hash.update(part);
+        }
+        return llvm::toHex(hash.final(), /* LowerCase*/true);
+    }
+
+    /**
+     * The entry of `key`, mapped, or null when there is none.
+     */
+    std::unique_ptr<llvm::MemoryBuffer> lookup(const std::string& key) const {
+        auto entry = llvm::MemoryBuffer::getFile(path(key), /* IsText*/false,
+            /* RequiresNullTerminator*/false);
+        return entry ? std::move(*entry) : nullptr;
+    }
+
+    /**
+     * Keeps `data` under `key`; false if it could not be written.
+     */
+    bool store(const std::string& key, llvm::StringRef data) {
+        auto entry = path(key);
+        if (llvm::sys::fs::create_directories(llvm::sys::path::parent_path(entry))) {
+            return false;
+        }
+        llvm::SmallString<128> temporary;
+        int fd;
+        if (llvm::sys::fs::createUniqueFile(entry + "-%%%%%%.tmp", fd, temporary)) {
+            return false;
+        }
+        {
+            llvm::raw_fd_ostream out(fd, /* shouldClose*/true);
+            out << data;
+            out.close();
+            if (out.has_error()) {
+                out.clear_error();
+                llvm::sys::fs::remove(temporary);
+                return false;
+            }
+        }
+        if (llvm::sys::fs::rename(temporary, entry)) {
+            llvm::sys::fs::remove(temporary);
+            return false;
+        }
+        return true;
+    }
+
+    void notifyObjectCompiled(const llvm::Module* module, llvm::MemoryBufferRef object) override {
+        if (isKey(module->getModuleIdentifier())) {
+            store(module->getModuleIdentifier(), object.getBuffer());
+        }
+    }
+
+    std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module* module) override {
+        return isKey(module->getModuleIdentifier()) ? lookup(module->getModuleIdentifier()) : nullptr;
+    }
+
+private:
+    static bool isKey(llvm::StringRef name) {
+        return name.size() == 64 && name.find_first_not_of("0123456789abcdef") == llvm::StringRef::npos;
+    }
+
+    std::string path(const std::string& key) const {
+        llvm::SmallString<128> path(directory_);
+        llvm::sys::path::append(path, key.substr(0, 2), key.substr(2));
+        return std::string(path);
+    }
+
+    std::string directory_;
+};
+
+#endif
@@ -2,66 +2,127 @@
 #ifndef Environment_h
 #define Environment_h
 
-#include <map>
-#include <memory>
-#include <string>
+#include <cstdint>
+#include <vector>
 
-#include "llvm/IR/Value.h"
+#include "Symbols.h"
 
 /**
- * Environment: names storage.
+ * Environment: the slot each name in scope is bound to (see Resolver), as
+ * a stack of scopes.
+ *
+ * Bindings are kept on one stack in the order they are defined, a scope
+ * being the bindings above its mark. An open addressing table maps each
+ * name to its innermost binding, and every binding links to the one it
+ * shadows, so lookups cost the same at any nesting depth and leaving a
+ * scope just unlinks its bindings. Nothing is allocated per scope.
  */
-class Environment : public std::enable_shared_from_this<Environment> {
+class Environment {
 public:
+    static constexpr uint32_t None = UINT32_MAX;
+
+    Environment() : slots_(64) { pushScope(); }
+
     /**
-     * Creates an environment with the given record.
+     * Enters a scope for as long as it lives.
      */
-    Environment(std::map<std::string, llvm::Value*> record,
-        std::shared_ptr<Environment> parent)
-        : record_(record), parent_(parent) {}
+    class Scope {
+    public:
+        explicit Scope(Environment& env) : env_(env) { env_.pushScope(); }
+        ~Scope() { env_.popScope(); }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        Environment& env_;
+    };
+
+    void pushScope() { scopes_.push_back(static_cast<uint32_t>(bindings_.size())); }
 
     /**
-     * Creates a variable with the given name and value.
+     * Leaves the innermost scope, dropping the bindings made in it.
      */
-    llvm::Value* define(const std::string& name, llvm::Value* value) {
-        record_[name] = value;
+    void popScope() {
+        for (auto end = scopes_.back(); bindings_.size() > end; bindings_.pop_back()) {
+            slots_[find(bindings_.back().name)].binding = bindings_.back().shadowed;
+        }
+        scopes_.pop_back();
+    }
+
+    /**
+     * Binds the given name to a slot in the innermost scope.
+     */
+    uint32_t define(Symbol name, uint32_t value) {
+        auto slot = find(name);
+        if (slots_[slot].name == SymbolTable::None) {
+            slots_[slot].name = name;
+            if (++used_ * 2 > slots_.size()) {
+                grow();
+                slot = find(name);
+            }
+        }
+        bindings_.push_back({ name, slots_[slot].binding, value });
+        slots_[slot].binding = static_cast<uint32_t>(bindings_.size() - 1);
         return value;
     }
 
     /**
-     * Returns the value of a defined variable, or throws
-     * if the variable is not defined.
+     * Returns the slot of the innermost binding of the given name, or None
+     * if it is not defined.
      */
-    llvm::Value* lookup(const std::string& name) {
-        return resolve(name)->record_[name];
+    uint32_t lookup(Symbol name) const {
+        auto binding = slots_[find(name)].binding;
+        return binding == None ? None : bindings_[binding].value;
     }
 
 private:
+    struct Binding {
+        Symbol name;
+        uint32_t shadowed; // the binding this one hides, or None
+        uint32_t value;
+    };
+
     /**
-     * Returns specific environment in which a variable is defined, or
-     * throws if a variable is not defined.
+     * A name seen in this environment and its innermost binding. Names
+     * stay once seen, so there are no deletions to probe past.
      */
-    std::shared_ptr<Environment> resolve(const std::string& name) {
-        if (record_.count(name)!=0)
-        {
-            return shared_from_this();
+    struct Slot {
+        Symbol name = SymbolTable::None;
+        uint32_t binding = None;
+    };
+
+    // the slot of `name`, or the empty slot where it goes
+    size_t find(Symbol name) const {
+        size_t mask = slots_.size() - 1;
+        size_t i = (name * 0x9E3779B1u) & mask;
+        while (slots_[i].name != name && slots_[i].name != SymbolTable::None) {
+            i = (i + 1) & mask;
         }
-        if (parent_==nullptr)
-        {
-            exit(EXIT_FAILURE);
+        return i;
+    }
+
+    void grow() {
+        auto slots = std::move(slots_);
+        slots_.assign(slots.size() * 2, Slot{});
+        for (auto& slot : slots) {
+            if (slot.name != SymbolTable::None) {
+                slots_[find(slot.name)] = slot;
+            }
         }
-        return parent_->resolve(name);
     }
 
+    std::vector<Slot> slots_;
+    size_t used_ = 0;
+
     /**
-     * Bindings storage
+     * Bindings storage, innermost last
      */
-    std::map<std::string, llvm::Value*> record_;
+    std::vector<Binding> bindings_;
 
     /**
-     * Parent link
+     * Where each open scope's bindings start
      */
-    std::shared_ptr<Environment> parent_;
+    std::vector<uint32_t> scopes_;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,553 @@
+#pragma once
+#ifndef FlatAst_h
+#define FlatAst_h
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../ast.h"
+#include "Symbols.h"
+
+using NodeId = uint32_t;
+
+/**
+ * FlatAst: the program as contiguous typed arrays addressed by 32-bit
+ * node IDs.
+ *
+ * Every node is a kind, an operator/type token and three 32-bit operands,
+ * 14 bytes in all, stored column-wise. Nodes are laid out in pre-order, so
+ * a walk over a subtree reads the arrays front to back. What the operands
+ * hold depends on the kind:
+ *
+ *   kind                 op              first     second    third
+ *   ExpressionStatement                  expr
+ *   Let                  LET or MUT      name      value
+ *   Return                               value
+ *   Block                                list
+ *   Function             return type     name      params    body
+ *   Identifier           param type      name
+ *   Integer                              integer
+ *   Float                                real
+ *   Boolean                              0 or 1
+ *   String                               text
+ *   Prefix               operator        right
+ *   Infix                operator        left      right
+ *   Index                                left      index
+ *   If                                   cond      then      else
+ *   While                                cond      body
+ *   Call                                 function  args
+ *   Array                                elements
+ *   Hash                                 pairs (key, value, key, ...)
+ *
+ * Node operands are IDs or None, "list" operands index lists() and text
+ * operands index text(). Name operands number the distinct names of the
+ * program; symbol() maps them to the process wide Symbol, name() to their
+ * text. Integer and float payloads live in their own arrays.
+ *
+ * The arrays are position independent, so write() dumps them as they are
+ * and load() reads them back by pointing at a (memory mapped) image,
+ * without touching the nodes. Symbols depend on what the process interned
+ * before, so only the names are stored and load() interns them again.
+ */
+class FlatAst {
+public:
+    static constexpr NodeId None = UINT32_MAX;
+
+    /**
+     * Lowers a parsed program. The FlatAst keeps its own copy of all text
+     * and does not refer to the program afterwards.
+     */
+    explicit FlatAst(const Program& program) {
+        std::vector<NodeId> roots;
+        roots.reserve(program.TopLevels.size());
+        for (auto unit : program.TopLevels) {
+            if (unit.statement != nullptr) {
+                roots.push_back(lower(unit.statement));
+            }
+        }
+        roots_ = addList(roots);
+        nameOf_ = {};
+        view_ = { kinds_, ops_, first_, second_, third_, lists_, integers_, reals_, textOffsets_, nameTexts_, pool_, roots_ };
+    }
+
+    /**
+     * Uses an image made by write() in place. Returns null if it was
+     * written for another source (hash and size), by another version of
+     * the format or on a machine with another layout, is truncated, or
+     * has a node, list or text reference out of range (see valid()).
+     * The image must stay valid as long as `owner` lives; the FlatAst
+     * holds on to it.
+     */
+    static std::unique_ptr<FlatAst> load(std::string_view image, uint64_t sourceHash, uint64_t sourceSize, std::shared_ptr<const void> owner) {
+        CacheHeader header;
+        if (image.size() < sizeof header || reinterpret_cast<uintptr_t>(image.data()) % alignof(uint64_t) != 0) {
+            return nullptr;
+        }
+        std::memcpy(&header, image.data(), sizeof header);
+        auto expected = CacheHeader::make(sourceHash, sourceSize);
+        if (std::memcmp(&header, &expected, offsetof(CacheHeader, nodes)) != 0) {
+            return nullptr;
+        }
+        std::unique_ptr<FlatAst> ast(new FlatAst());
+        size_t at = sizeof header;
+        bool ok = ast->take(image, at, ast->view_.integers, header.integers)
+            && ast->take(image, at, ast->view_.reals, header.reals)
+            && ast->take(image, at, ast->view_.first, header.nodes)
+            && ast->take(image, at, ast->view_.second, header.nodes)
+            && ast->take(image, at, ast->view_.third, header.nodes)
+            && ast->take(image, at, ast->view_.lists, header.lists)
+            && ast->take(image, at, ast->view_.textOffsets, header.texts)
+            && ast->take(image, at, ast->view_.nameTexts, header.names)
+            && ast->take(image, at, ast->view_.kinds, header.nodes)
+            && ast->take(image, at, ast->view_.ops, header.nodes);
+        std::span<const char> pool;
+        if (!ok || !ast->take(image, at, pool, header.poolSize) || at != image.size()
+            || header.roots >= header.lists || header.texts == 0 || ast->view_.textOffsets.back() != header.poolSize) {
+            return nullptr;
+        }
+        ast->view_.pool = std::string_view(pool.data(), pool.size());
+        ast->view_.roots = header.roots;
+        if (!ast->valid()) {
+            return nullptr;
+        }
+        auto& symbols = SymbolTable::global();
+        ast->symbols_.reserve(header.names);
+        for (auto text : ast->view_.nameTexts) {
+            if (text + 1 >= header.texts) {
+                return nullptr;
+            }
+            ast->symbols_.push_back(symbols.intern(ast->text(text)));
+        }
+        ast->owner_ = std::move(owner);
+        return ast;
+    }
+
+    /**
+     * Writes the image load() reads, tagged with the source it was made
+     * from.
+     */
+    void write(std::ostream& out, uint64_t sourceHash, uint64_t sourceSize) const {
+        auto header = CacheHeader::make(sourceHash, sourceSize);
+        header.nodes = static_cast<uint32_t>(view_.kinds.size());
+        header.lists = static_cast<uint32_t>(view_.lists.size());
+        header.integers = static_cast<uint32_t>(view_.integers.size());
+        header.reals = static_cast<uint32_t>(view_.reals.size());
+        header.texts = static_cast<uint32_t>(view_.textOffsets.size());
+        header.names = static_cast<uint32_t>(view_.nameTexts.size());
+        header.poolSize = static_cast<uint32_t>(view_.pool.size());
+        header.roots = view_.roots;
+        out.write(reinterpret_cast<const char*>(&header), sizeof header);
+        put(out, view_.integers);
+        put(out, view_.reals);
+        put(out, view_.first);
+        put(out, view_.second);
+        put(out, view_.third);
+        put(out, view_.lists);
+        put(out, view_.textOffsets);
+        put(out, view_.nameTexts);
+        put(out, view_.kinds);
+        put(out, view_.ops);
+        put(out, std::span<const char>(view_.pool.data(), view_.pool.size()));
+    }
+
+    /**
+     * Bump when the image layout or what lowering produces changes.
+     */
+    static constexpr uint32_t CacheVersion = 2;
+
+    FlatAst(const FlatAst&) = delete;
+    FlatAst& operator=(const FlatAst&) = delete;
+
+    size_t size() const { return view_.kinds.size(); }
+
+    NodeKind kind(NodeId id) const { return view_.kinds[id]; }
+    TokenType op(NodeId id) const { return view_.ops[id]; }
+    uint32_t first(NodeId id) const { return view_.first[id]; }
+    uint32_t second(NodeId id) const { return view_.second[id]; }
+    uint32_t third(NodeId id) const { return view_.third[id]; }
+
+    /**
+     * The top-level statements.
+     */
+    std::span<const NodeId> roots() const { return list(view_.roots); }
+
+    std::span<const NodeId> list(uint32_t list) const {
+        return { view_.lists.data() + list + 1, view_.lists[list] };
+    }
+
+    std::string_view text(uint32_t text) const {
+        return view_.pool.substr(view_.textOffsets[text], view_.textOffsets[text + 1] - view_.textOffsets[text]);
+    }
+
+    Symbol symbol(uint32_t name) const { return symbols_[name]; }
+    std::string_view name(uint32_t name) const { return text(view_.nameTexts[name]); }
+
+    int64_t integer(NodeId id) const { return view_.integers[view_.first[id]]; }
+    double real(NodeId id) const { return view_.reals[view_.first[id]]; }
+
+    /**
+     * Bytes held by the node, list and payload arrays.
+     */
+    size_t bytesUsed() const {
+        return view_.kinds.size() * (sizeof(NodeKind) + sizeof(TokenType) + 3 * sizeof(uint32_t))
+            + view_.lists.size() * sizeof(uint32_t) + view_.integers.size() * sizeof(int64_t)
+            + view_.reals.size() * sizeof(double) + view_.textOffsets.size() * sizeof(uint32_t) + view_.pool.size()
+            + view_.nameTexts.size() * sizeof(uint32_t) + symbols_.size() * sizeof(Symbol);
+    }
+
+private:
+    FlatAst() = default;
+
+    /**
+     * Starts an image: what it was made from and the array sizes. The
+     * fields up to `nodes` must match for an image to be used.
+     */
+    struct CacheHeader {
+        char magic[4];
+        uint32_t version;
+        uint32_t byteOrder;
+        uint16_t tokenTypes;
+        uint16_t nodeKindSize;
+        uint64_t sourceHash;
+        uint64_t sourceSize;
+        uint32_t nodes, lists, integers, reals, texts, names, poolSize, roots;
+
+        static CacheHeader make(uint64_t sourceHash, uint64_t sourceSize) {
+            return CacheHeader{ { 'C', 'M', 'A', 'S' }, CacheVersion, 0x01020304, TOKEN_TYPE_COUNT,
+                sizeof(NodeKind), sourceHash, sourceSize };
+        }
+    };
+
+    /**
+     * Whether everything the accessors could be asked for is in range, so
+     * that a damaged image is refused rather than read out of bounds:
+     * every kind and operator is known, texts lie in the pool in order,
+     * each operand is in range for its kind, lists fit in lists(), and
+     * children come after their parent, as lowering lays them out (so a
+     * walk cannot loop).
+     */
+    bool valid() const {
+        auto nodes = view_.kinds.size(), texts = view_.textOffsets.size() - 1;
+        for (size_t t = 0; t < texts; t++) {
+            if (view_.textOffsets[t] > view_.textOffsets[t + 1]) {
+                return false;
+            }
+        }
+        // a child of `parent` (None for the roots), or None
+        auto child = [&](NodeId parent, uint32_t id) {
+            return id == None || ((parent == None || id > parent) && id < nodes);
+        };
+        auto list = [&](NodeId parent, uint32_t list) {
+            if (list >= view_.lists.size() || view_.lists[list] > view_.lists.size() - list - 1) {
+                return false;
+            }
+            for (auto item : this->list(list)) {
+                if (!child(parent, item)) {
+                    return false;
+                }
+            }
+            return true;
+        };
+        if (!list(None, view_.roots)) {
+            return false;
+        }
+        for (NodeId id = 0; id < nodes; id++) {
+            auto first = view_.first[id], second = view_.second[id], third = view_.third[id];
+            if (view_.ops[id] >= TOKEN_TYPE_COUNT) {
+                return false;
+            }
+            bool ok;
+            switch (view_.kinds[id]) {
+            case NodeKind::ExpressionStatement:
+            case NodeKind::Return:
+                ok = child(id, first);
+                break;
+            case NodeKind::Let:
+                ok = first < view_.nameTexts.size() && child(id, second);
+                break;
+            case NodeKind::Block:
+            case NodeKind::Array:
+                ok = list(id, first);
+                break;
+            case NodeKind::Hash:
+                ok = list(id, first) && view_.lists[first] % 2 == 0;
+                break;
+            case NodeKind::Function:
+                ok = first < view_.nameTexts.size() && list(id, second) && child(id, third);
+                break;
+            case NodeKind::Identifier:
+                ok = first < view_.nameTexts.size();
+                break;
+            case NodeKind::Integer:
+                ok = first < view_.integers.size();
+                break;
+            case NodeKind::Float:
+                ok = first < view_.reals.size();
+                break;
+            case NodeKind::Boolean:
+                ok = first <= 1;
+                break;
+            case NodeKind::String:
+                ok = first < texts;
+                break;
+            case NodeKind::Prefix:
+                ok = child(id, first);
+                break;
+            case NodeKind::Infix:
+            case NodeKind::Index:
+            case NodeKind::While:
+                ok = child(id, first) && child(id, second);
+                break;
+            case NodeKind::If:
+                ok = child(id, first) && child(id, second) && child(id, third);
+                break;
+            case NodeKind::Call:
+                ok = child(id, first) && list(id, second);
+                break;
+            default:
+                ok = false;
+                break;
+            }
+            if (!ok) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // arrays are padded to 8 bytes in the image, so all of them stay aligned
+    static constexpr size_t CacheAlign = 8;
+
+    template <typename T>
+    static void put(std::ostream& out, std::span<const T> items) {
+        static const char padding[CacheAlign] = {};
+        auto bytes = items.size() * sizeof(T);
+        out.write(reinterpret_cast<const char*>(items.data()), bytes);
+        out.write(padding, (CacheAlign - bytes % CacheAlign) % CacheAlign);
+    }
+
+    template <typename T>
+    static bool take(std::string_view image, size_t& at, std::span<const T>& items, size_t count) {
+        auto bytes = count * sizeof(T);
+        if (image.size() - at < bytes) {
+            return false;
+        }
+        items = { reinterpret_cast<const T*>(image.data() + at), count };
+        at += (bytes + CacheAlign - 1) / CacheAlign * CacheAlign;
+        return at <= image.size();
+    }
+
+    NodeId add(NodeKind kind, TokenType op = ILLEGAL, uint32_t first = None, uint32_t second = None, uint32_t third = None) {
+        kinds_.push_back(kind);
+        ops_.push_back(op);
+        first_.push_back(first);
+        second_.push_back(second);
+        third_.push_back(third);
+        return static_cast<NodeId>(kinds_.size() - 1);
+    }
+
+    uint32_t addList(const std::vector<NodeId>& items) {
+        auto list = static_cast<uint32_t>(lists_.size());
+        lists_.push_back(static_cast<uint32_t>(items.size()));
+        lists_.insert(lists_.end(), items.begin(), items.end());
+        return list;
+    }
+
+    uint32_t addText(std::string_view text) {
+        pool_.append(text);
+        textOffsets_.push_back(static_cast<uint32_t>(pool_.size()));
+        return static_cast<uint32_t>(textOffsets_.size() - 2);
+    }
+
+    uint32_t addName(Symbol symbol) {
+        if (symbol >= nameOf_.size()) {
+            nameOf_.resize(symbol + 1, None);
+        }
+        if (nameOf_[symbol] == None) {
+            nameOf_[symbol] = static_cast<uint32_t>(symbols_.size());
+            symbols_.push_back(symbol);
+            nameTexts_.push_back(addText(SymbolTable::global().name(symbol)));
+        }
+        return nameOf_[symbol];
+    }
+
+    template <typename T>
+    uint32_t lowerList(std::span<T*> items) {
+        std::vector<NodeId> ids;
+        ids.reserve(items.size());
+        for (auto* item : items) {
+            ids.push_back(lower(item));
+        }
+        return addList(ids);
+    }
+
+    /**
+     * Lowers one node; parents are added before their children so a
+     * subtree occupies a run of IDs.
+     */
+    NodeId lower(Node* node) {
+        if (node == nullptr) {
+            return None;
+        }
+        switch (node->Kind) {
+        case NodeKind::Infix: {
+            auto* infix = static_cast<InfixExpression*>(node);
+            auto id = add(NodeKind::Infix, infix->Token.Type);
+            first_[id] = lower(infix->Left);
+            second_[id] = lower(infix->Right);
+            return id;
+        }
+        case NodeKind::Identifier: {
+            auto* ident = static_cast<::Identifier*>(node);
+            return add(NodeKind::Identifier, ident->type, addName(ident->Name));
+        }
+        case NodeKind::Integer:
+            integers_.push_back(static_cast<IntegerLiteral*>(node)->Value);
+            return add(NodeKind::Integer, ILLEGAL, static_cast<uint32_t>(integers_.size() - 1));
+        case NodeKind::Float:
+            reals_.push_back(static_cast<FloatLiteral*>(node)->Value);
+            return add(NodeKind::Float, ILLEGAL, static_cast<uint32_t>(reals_.size() - 1));
+        case NodeKind::ExpressionStatement: {
+            auto id = add(NodeKind::ExpressionStatement);
+            first_[id] = lower(static_cast<ExpressionStatement*>(node)->Expression);
+            return id;
+        }
+        case NodeKind::Let: {
+            auto* let = static_cast<LetStatement*>(node);
+            auto id = add(NodeKind::Let, let->Token.Type, addName(let->Name->Name));
+            second_[id] = lower(let->Value);
+            return id;
+        }
+        case NodeKind::Boolean:
+            return add(NodeKind::Boolean, ILLEGAL, static_cast<::Boolean*>(node)->Value ? 1 : 0);
+        case NodeKind::Prefix: {
+            auto* prefix = static_cast<PrefixExpression*>(node);
+            auto id = add(NodeKind::Prefix, prefix->Token.Type);
+            first_[id] = lower(prefix->Right);
+            return id;
+        }
+        case NodeKind::Call: {
+            auto* call = static_cast<CallExpression*>(node);
+            auto id = add(NodeKind::Call);
+            first_[id] = lower(call->Function);
+            second_[id] = lowerList(call->Arguments);
+            return id;
+        }
+        case NodeKind::Block: {
+            auto id = add(NodeKind::Block);
+            first_[id] = lowerList(static_cast<BlockStatement*>(node)->Statements);
+            return id;
+        }
+        case NodeKind::Return: {
+            auto id = add(NodeKind::Return);
+            first_[id] = lower(static_cast<ReturnStatement*>(node)->ReturnValue);
+            return id;
+        }
+        case NodeKind::If: {
+            auto* ifexpr = static_cast<IfExpression*>(node);
+            auto id = add(NodeKind::If);
+            first_[id] = lower(ifexpr->Condition);
+            second_[id] = lower(ifexpr->Consequence);
+            third_[id] = lower(ifexpr->Alternative);
+            return id;
+        }
+        case NodeKind::While: {
+            auto* loop = static_cast<WhileExpression*>(node);
+            auto id = add(NodeKind::While);
+            first_[id] = lower(loop->Condition);
+            second_[id] = lower(loop->Body);
+            return id;
+        }
+        case NodeKind::Function: {
+            auto* fn = static_cast<FunctionLiteral*>(node);
+            auto id = add(NodeKind::Function, fn->Type.Type, addName(fn->Name));
+            second_[id] = lowerList(fn->Parameters);
+            third_[id] = lower(fn->Body);
+            return id;
+        }
+        case NodeKind::String:
+            return add(NodeKind::String, ILLEGAL, addText(static_cast<StringLiteral*>(node)->Value));
+        case NodeKind::Array: {
+            auto id = add(NodeKind::Array);
+            first_[id] = lowerList(static_cast<ArrayLiteral*>(node)->Elements);
+            return id;
+        }
+        case NodeKind::Index: {
+            auto* index = static_cast<IndexExpression*>(node);
+            auto id = add(NodeKind::Index);
+            first_[id] = lower(index->Left);
+            second_[id] = lower(index->Index);
+            return id;
+        }
+        case NodeKind::Hash: {
+            auto id = add(NodeKind::Hash);
+            std::vector<NodeId> pairs;
+            for (auto& [key, value] : static_cast<HashLiteral*>(node)->Pairs) {
+                pairs.push_back(lower(key));
+                pairs.push_back(lower(value));
+            }
+            first_[id] = addList(pairs);
+            return id;
+        }
+        default:
+            return None;
+        }
+    }
+
+    std::vector<NodeKind> kinds_;
+    std::vector<TokenType> ops_;
+    std::vector<uint32_t> first_;
+    std::vector<uint32_t> second_;
+    std::vector<uint32_t> third_;
+
+    /**
+     * Lists: a count followed by the items.
+     */
+    std::vector<uint32_t> lists_;
+    uint32_t roots_ = 0;
+
+    std::vector<int64_t> integers_;
+    std::vector<double> reals_;
+
+    /**
+     * Text i is pool_[textOffsets_[i], textOffsets_[i + 1]).
+     */
+    std::string pool_;
+    std::vector<uint32_t> textOffsets_{ 0 };
+
+    /**
+     * Name i is text nameTexts_[i], Symbol symbols_[i]; symbols_ is filled
+     * by load() for a loaded image too.
+     */
+    std::vector<uint32_t> nameTexts_;
+    std::vector<Symbol> symbols_;
+
+    // lowering only: the name of each Symbol seen, or None
+    std::vector<uint32_t> nameOf_;
+
+    /**
+     * What the accessors read: the arrays above, or a loaded image.
+     */
+    struct View {
+        std::span<const NodeKind> kinds;
+        std::span<const TokenType> ops;
+        std::span<const uint32_t> first, second, third, lists;
+        std::span<const int64_t> integers;
+        std::span<const double> reals;
+        std::span<const uint32_t> textOffsets, nameTexts;
+        std::string_view pool;
+        uint32_t roots = 0;
+    } view_;
+
+    // keeps a loaded image alive
+    std::shared_ptr<const void> owner_;
+};
+
+#endif
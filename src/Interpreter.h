@@ -0,0 +1,859 @@
+#pragma once
+#ifndef Interpreter_h
+#define Interpreter_h
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <format>
+#include <functional>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "FlatAst.h"
+#include "Resolver.h"
+
+/**
+ * Interpreter: the first tier of the tiered engine, runs a FlatAst as it
+ * is, with no code generation.
+ *
+ * It follows the semantics of the code Cminus generates: integers wrap at
+ * their width and compare signed, >> shifts in zeros, mixed operands are
+ * converted to the wider type, and arguments, returns and assignments to
+ * the declared types. Names are read through the slots of the Resolution;
+ * a call saves the slots of the callee's frame and restores them when it
+ * returns, so recursion sees its own locals.
+ *
+ * Each function counts its calls and the iterations of the loops run in
+ * it. Once the count reaches the threshold, the next call hands the
+ * function and the functions it calls to the Compile hook, and if that
+ * returns native code every later call goes there. The hook may decline:
+ * code that uses the top-level variables, whose values live here, stays
+ * interpreted.
+ *
+ * An if takes the value of the branch taken; the generated code converts
+ * it to the type of the consequence, which the interpreter does not know
+ * when the alternative runs.
+ */
+class Interpreter {
+public:
+    struct Value {
+        enum Kind : uint8_t { Unset, Void, Int, Real, String, Function, Array };
+
+        Kind kind = Unset;
+        uint8_t bits = 0; // Int: 1, 8, 16, 32 or 64, Real: 32 or 64
+        int64_t integer = 0; // Int, sign extended (i1: 0 or 1); Function: the defining node or Printf
+        double real = 0;
+        const char* string = nullptr;
+
+        static constexpr int64_t Printf = -1;
+
+        static Value ofInt(int64_t integer, unsigned bits) {
+            Value value{ Int, static_cast<uint8_t>(bits) };
+            value.integer = wrap(integer, bits);
+            return value;
+        }
+        static Value ofReal(double real, unsigned bits) {
+            Value value{ Real, static_cast<uint8_t>(bits) };
+            value.real = bits == 32 ? static_cast<float>(real) : real;
+            return value;
+        }
+        static Value function(int64_t node) {
+            Value value{ Function };
+            value.integer = node;
+            return value;
+        }
+        /**
+         * The host's printf, as programs call it.
+         */
+        static Value printf() { return function(Printf); }
+
+        bool sameType(const Value& other) const { return kind == other.kind && bits == other.bits; }
+    };
+
+    /**
+     * Native code of a function: reads its arguments from cells[0..n) and
+     * writes its result to cells[0], each in the low bytes of its cell.
+     */
+    using Native = void (*)(uint64_t* cells);
+
+    /**
+     * Compiles `function` with the functions it calls, or returns null.
+     */
+    using Compile = std::function<Native(NodeId function, std::span<const NodeId> callees)>;
+
+    Interpreter(const FlatAst& ast, const Resolution& resolution, Compile compile, uint32_t threshold)
+        : ast_(ast), resolution_(resolution), compile_(std::move(compile)), threshold_(threshold) {
+        values_.resize(resolution.slots());
+    }
+
+    /**
+     * Sets a slot the runtime predefines (see Resolver::predefine).
+     */
+    void define(uint32_t slot, Value value) { values_[slot] = value; }
+
+    /**
+     * Runs the program; returns what main returns, or nothing when it
+     * failed (see errors()).
+     */
+    std::optional<int64_t> run() {
+        for (auto stmt : ast_.roots()) {
+            eval(stmt);
+            if (unwind_ == Unwind::Error) {
+                return std::nullopt;
+            }
+            if (unwind_ == Unwind::Return) {
+                return returned_.integer;
+            }
+        }
+        return 0;
+    }
+
+    const std::vector<std::string>& errors() const { return errors_; }
+
+    /**
+     * Functions that went native.
+     */
+    size_t promoted() const { return promoted_; }
+
+private:
+    enum class Unwind : uint8_t { None, Return, Error };
+
+    struct FunctionState {
+        uint32_t count = 0; // calls and loop iterations
+        bool tried = false;
+        Native native = nullptr;
+    };
+
+    static int64_t wrap(int64_t value, unsigned bits) {
+        if (bits == 1) {
+            return value & 1;
+        }
+        if (bits >= 64) {
+            return value;
+        }
+        auto shift = 64 - bits;
+        return static_cast<int64_t>(static_cast<uint64_t>(value) << shift) >> shift;
+    }
+
+    static Value typeOf(TokenType type) {
+        switch (type) {
+        case BOOLEAN:
+            return { Value::Int, 1 };
+        case I8:
+            return { Value::Int, 8 };
+        case I16:
+            return { Value::Int, 16 };
+        case I32:
+            return { Value::Int, 32 };
+        case I64:
+            return { Value::Int, 64 };
+        case FLOAT:
+            return { Value::Real, 32 };
+        case DOUBLE:
+            return { Value::Real, 64 };
+        default:
+            return { Value::Void };
+        }
+    }
+
+    static bool truth(const Value& value) {
+        switch (value.kind) {
+        case Value::Int:
+            return value.integer != 0;
+        case Value::Real:
+            return value.real != 0 || std::isnan(value.real);
+        case Value::String:
+            return value.string != nullptr;
+        default:
+            return true;
+        }
+    }
+
+    // as Cminus::convert; nothing when there is no such conversion
+    static std::optional<Value> convert(const Value& value, const Value& type) {
+        if (value.sameType(type)) {
+            return value;
+        }
+        if (value.kind == Value::Int && type.kind == Value::Int) {
+            return Value::ofInt(value.integer, type.bits);
+        }
+        if (value.kind == Value::Int && type.kind == Value::Real) {
+            return Value::ofReal(static_cast<double>(value.integer), type.bits);
+        }
+        if (value.kind == Value::Real && type.kind == Value::Int) {
+            if (type.bits == 1) {
+                return Value::ofInt(truth(value) ? 1 : 0, 1);
+            }
+            // out of range is poison in the generated code
+            bool fits = value.real > -9.2e18 && value.real < 9.2e18;
+            return Value::ofInt(fits ? static_cast<int64_t>(value.real) : 0, type.bits);
+        }
+        if (value.kind == Value::Real && type.kind == Value::Real) {
+            return Value::ofReal(value.real, type.bits);
+        }
+        if (value.kind == Value::String && type.kind == Value::String) {
+            return value;
+        }
+        return std::nullopt;
+    }
+
+    static bool numeric(const Value& value) { return value.kind == Value::Int || value.kind == Value::Real; }
+
+    /**
+     * The type the generated code gives the value of `node`, found
+     * without evaluating it; Void where it is not a number, a string or
+     * a boolean. An if's value has this type of its consequence.
+     */
+    Value resultType(NodeId node) const {
+        if (node == FlatAst::None) {
+            return { Value::Int, 32 };
+        }
+        switch (ast_.kind(node)) {
+        case NodeKind::ExpressionStatement:
+            return resultType(ast_.first(node));
+        case NodeKind::Let:
+            // a mut is a store, it has no value
+            return ast_.op(node) == MUT ? Value{ Value::Void } : resultType(ast_.second(node));
+        case NodeKind::Block: {
+            auto type = Value{ Value::Int, 32 };
+            for (auto stmt : ast_.list(ast_.first(node))) {
+                type = resultType(stmt);
+                if (stmt != FlatAst::None && ast_.kind(stmt) == NodeKind::Return) {
+                    break;
+                }
+            }
+            return type;
+        }
+        case NodeKind::If: {
+            auto type = resultType(ast_.second(node));
+            return type.kind == Value::Void || ast_.third(node) == FlatAst::None ? Value{ Value::Int, 32 } : type;
+        }
+        case NodeKind::Identifier: {
+            auto slot = resolution_.binding(node);
+            return slot != Resolution::None && (numeric(values_[slot]) || values_[slot].kind == Value::String)
+                ? Value{ values_[slot].kind, values_[slot].bits }
+                : Value{ Value::Void };
+        }
+        case NodeKind::Integer:
+            return { Value::Int, 32 };
+        case NodeKind::Float:
+            return { Value::Real, 64 };
+        case NodeKind::Boolean:
+            return { Value::Int, 1 };
+        case NodeKind::String:
+            return { Value::String };
+        case NodeKind::Prefix:
+            return resultType(ast_.first(node));
+        case NodeKind::Infix: {
+            switch (ast_.op(node)) {
+            case LOGICAL_AND:
+            case LOGICAL_OR:
+            case LT:
+            case GT:
+            case EQ:
+            case NOT_EQ:
+            case GT_EQ:
+            case LT_EQ:
+                return { Value::Int, 1 };
+            default:
+                break;
+            }
+            auto left = resultType(ast_.first(node)), right = resultType(ast_.second(node));
+            if (!numeric(left) || !numeric(right)) {
+                return { Value::Void };
+            }
+            if ((left.kind == Value::Real) != (right.kind == Value::Real)) {
+                return left.kind == Value::Real ? left : right;
+            }
+            return left.bits >= right.bits ? left : right;
+        }
+        case NodeKind::Call: {
+            auto callee = ast_.first(node);
+            if (callee == FlatAst::None || ast_.kind(callee) != NodeKind::Identifier) {
+                return { Value::Void };
+            }
+            auto slot = resolution_.binding(callee);
+            if (slot == Resolution::None || values_[slot].kind != Value::Function) {
+                return { Value::Void };
+            }
+            auto function = values_[slot].integer;
+            return function == Value::Printf ? Value{ Value::Int, 32 } : typeOf(ast_.op(static_cast<NodeId>(function)));
+        }
+        default:
+            return { Value::Void };
+        }
+    }
+
+    Value fail(std::string error) {
+        if (unwind_ != Unwind::Error) {
+            errors_.push_back(std::move(error));
+            unwind_ = Unwind::Error;
+        }
+        return {};
+    }
+
+    bool unwinding() const { return unwind_ != Unwind::None; }
+
+    Value eval(NodeId node) {
+        if (node == FlatAst::None) {
+            return Value::ofInt(0, 32);
+        }
+        switch (ast_.kind(node)) {
+        case NodeKind::ExpressionStatement:
+            return eval(ast_.first(node));
+        case NodeKind::While:
+            while (true) {
+                auto cond = eval(ast_.first(node));
+                if (unwinding() || !truth(cond)) {
+                    break;
+                }
+                eval(ast_.second(node));
+                if (unwinding()) {
+                    break;
+                }
+                if (current_ != nullptr) {
+                    current_->count++;
+                }
+            }
+            return Value::ofInt(0, 32);
+        case NodeKind::Block: {
+            auto result = Value::ofInt(0, 32);
+            for (auto stmt : ast_.list(ast_.first(node))) {
+                result = eval(stmt);
+                if (unwinding()) {
+                    break;
+                }
+            }
+            return result;
+        }
+        case NodeKind::If: {
+            auto cond = eval(ast_.first(node));
+            if (unwinding()) {
+                return {};
+            }
+            if (truth(cond)) {
+                return eval(ast_.second(node));
+            }
+            auto result = eval(ast_.third(node));
+            // the alternative converts to the type of the consequence
+            auto type = resultType(ast_.second(node));
+            if (!unwinding() && numeric(result) && numeric(type)) {
+                return convert(result, type).value_or(result);
+            }
+            return result;
+        }
+        case NodeKind::String: {
+            auto text = ast_.first(node);
+            auto it = strings_.find(text);
+            if (it == strings_.end()) {
+                it = strings_.emplace(text, std::string(ast_.text(text))).first;
+            }
+            Value value{ Value::String };
+            value.string = it->second.c_str();
+            return value;
+        }
+        case NodeKind::Return: {
+            auto value = eval(ast_.first(node));
+            if (unwinding()) {
+                return {};
+            }
+            // main returns an i64
+            auto type = current_ != nullptr ? returnType_ : Value{ Value::Int, 64 };
+            if (!returnValue(value, type)) {
+                return {};
+            }
+            unwind_ = Unwind::Return;
+            return Value::ofInt(0, 32);
+        }
+        case NodeKind::Let: {
+            auto value = eval(ast_.second(node));
+            if (unwinding()) {
+                return {};
+            }
+            auto slot = resolution_.binding(node);
+            if (ast_.op(node) == MUT) {
+                auto& variable = values_[slot];
+                if (variable.kind == Value::Unset) {
+                    return fail(std::format("{} has no value", ast_.name(ast_.first(node))));
+                }
+                auto converted = variable.kind != Value::Function ? convert(value, variable) : std::nullopt;
+                if (!converted) {
+                    return fail(std::format("cannot assign to {}", ast_.name(ast_.first(node))));
+                }
+                variable = *converted;
+                return { Value::Void };
+            }
+            values_[slot] = value;
+            return value;
+        }
+        case NodeKind::Function: {
+            auto function = Value::function(node);
+            if (auto slot = resolution_.binding(node); slot != Resolution::None) {
+                values_[slot] = function;
+            }
+            return function;
+        }
+        case NodeKind::Call:
+            return call(node);
+        case NodeKind::Identifier: {
+            auto value = values_[resolution_.binding(node)];
+            if (value.kind == Value::Unset) {
+                return fail(std::format("{} has no value", ast_.name(ast_.first(node))));
+            }
+            return value;
+        }
+        case NodeKind::Integer:
+            return Value::ofInt(ast_.integer(node), 32);
+        case NodeKind::Float:
+            return Value::ofReal(ast_.real(node), 64);
+        case NodeKind::Boolean:
+            return Value::ofInt(ast_.first(node) != 0 ? 1 : 0, 1);
+        case NodeKind::Prefix: {
+            auto right = eval(ast_.first(node));
+            if (unwinding()) {
+                return {};
+            }
+            if (ast_.op(node) == BANG && right.kind == Value::Int) {
+                return Value::ofInt(~right.integer, right.bits);
+            }
+            if (ast_.op(node) == MINUS && right.kind == Value::Int) {
+                return Value::ofInt(static_cast<int64_t>(0 - static_cast<uint64_t>(right.integer)), right.bits);
+            }
+            if (ast_.op(node) == MINUS && right.kind == Value::Real) {
+                return Value::ofReal(-right.real, right.bits);
+            }
+            return fail(std::format("unsupported operator {}", TokenTypeString(ast_.op(node))));
+        }
+        case NodeKind::Infix: {
+            auto left = eval(ast_.first(node));
+            if (unwinding()) {
+                return {};
+            }
+            auto right = eval(ast_.second(node));
+            if (unwinding()) {
+                return {};
+            }
+            return infix(ast_.op(node), left, right);
+        }
+        case NodeKind::Array:
+            for (auto element : ast_.list(ast_.first(node))) {
+                eval(element);
+                if (unwinding()) {
+                    return {};
+                }
+            }
+            return { Value::Array };
+        default:
+            return Value::ofInt(0, 32);
+        }
+    }
+
+    // sets the value a return unwinds with, converted to `type`
+    bool returnValue(const Value& value, const Value& type) {
+        if (type.kind == Value::Void) {
+            returned_ = { Value::Void };
+            return true;
+        }
+        auto converted = convert(value, type);
+        if (!converted) {
+            fail("a function returns a value of the wrong type");
+            return false;
+        }
+        returned_ = *converted;
+        return true;
+    }
+
+    Value infix(TokenType op, Value left, Value right) {
+        // logical operations are on the truth of their operands
+        if (op == LOGICAL_AND || op == LOGICAL_OR) {
+            bool result = op == LOGICAL_AND ? truth(left) && truth(right) : truth(left) || truth(right);
+            return Value::ofInt(result ? 1 : 0, 1);
+        }
+        // mixed operands are converted to the wider type
+        if (!left.sameType(right) && numeric(left) && numeric(right)) {
+            bool leftWider = (left.kind == Value::Real) != (right.kind == Value::Real)
+                ? left.kind == Value::Real
+                : left.bits > right.bits;
+            if (leftWider) {
+                right = *convert(right, left);
+            }
+            else {
+                left = *convert(left, right);
+            }
+        }
+        if (left.kind == Value::Real && right.kind == Value::Real) {
+            auto a = left.real, b = right.real;
+            switch (op) {
+            case PLUS:
+                return Value::ofReal(a + b, left.bits);
+            case MINUS:
+                return Value::ofReal(a - b, left.bits);
+            case ASTERISK:
+                return Value::ofReal(a * b, left.bits);
+            case SLASH:
+                return Value::ofReal(a / b, left.bits);
+            // ordered comparisons: false when either is NaN
+            case LT:
+                return Value::ofInt(a < b ? 1 : 0, 1);
+            case GT:
+                return Value::ofInt(a > b ? 1 : 0, 1);
+            case EQ:
+                return Value::ofInt(a == b ? 1 : 0, 1);
+            case NOT_EQ:
+                return Value::ofInt(a < b || a > b ? 1 : 0, 1);
+            case GT_EQ:
+                return Value::ofInt(a >= b ? 1 : 0, 1);
+            case LT_EQ:
+                return Value::ofInt(a <= b ? 1 : 0, 1);
+            default:
+                break;
+            }
+        }
+        if (left.kind == Value::Int && right.kind == Value::Int) {
+            auto bits = left.bits;
+            // i1 is signed too: true is -1
+            auto a = bits == 1 ? -left.integer : left.integer;
+            auto b = bits == 1 ? -right.integer : right.integer;
+            auto ua = static_cast<uint64_t>(a), ub = static_cast<uint64_t>(b);
+            switch (op) {
+            case PLUS:
+                return Value::ofInt(static_cast<int64_t>(ua + ub), bits);
+            case MINUS:
+                return Value::ofInt(static_cast<int64_t>(ua - ub), bits);
+            case ASTERISK:
+                return Value::ofInt(static_cast<int64_t>(ua * ub), bits);
+            case SLASH:
+            case MODULO:
+                if (b == 0) {
+                    return fail("division by zero");
+                }
+                if (b == -1) {
+                    return Value::ofInt(op == SLASH ? static_cast<int64_t>(0 - ua) : 0, bits);
+                }
+                return Value::ofInt(op == SLASH ? a / b : a % b, bits);
+            // shifting by the width or more is poison in the generated code
+            case LSHIFT:
+                return Value::ofInt(ub < bits ? static_cast<int64_t>(ua << ub) : 0, bits);
+            case RSHIFT: {
+                auto mask = bits >= 64 ? ~uint64_t(0) : (uint64_t(1) << bits) - 1;
+                return Value::ofInt(ub < bits ? static_cast<int64_t>((ua & mask) >> ub) : 0, bits);
+            }
+            case LT:
+                return Value::ofInt(a < b ? 1 : 0, 1);
+            case GT:
+                return Value::ofInt(a > b ? 1 : 0, 1);
+            case EQ:
+                return Value::ofInt(a == b ? 1 : 0, 1);
+            case NOT_EQ:
+                return Value::ofInt(a != b ? 1 : 0, 1);
+            case GT_EQ:
+                return Value::ofInt(a >= b ? 1 : 0, 1);
+            case LT_EQ:
+                return Value::ofInt(a <= b ? 1 : 0, 1);
+            default:
+                break;
+            }
+        }
+        // anything else compares as the same value or not: only a function with itself
+        if (op == EQ || op == NOT_EQ) {
+            bool same = left.kind == Value::Function && right.kind == Value::Function && left.integer == right.integer;
+            return Value::ofInt(same == (op == EQ) ? 1 : 0, 1);
+        }
+        return fail(std::format("unsupported operator {}", TokenTypeString(op)));
+    }
+
+    Value call(NodeId node) {
+        auto callee = eval(ast_.first(node));
+        if (unwinding()) {
+            return {};
+        }
+        if (callee.kind != Value::Function) {
+            return fail("call of a value that is not a function");
+        }
+        auto argNodes = ast_.list(ast_.second(node));
+        std::span<const NodeId> params;
+        if (callee.integer != Value::Printf) {
+            params = ast_.list(ast_.second(static_cast<NodeId>(callee.integer)));
+        }
+        if (argNodes.size() < params.size()) {
+            return fail("too few arguments");
+        }
+        std::vector<Value> args;
+        args.reserve(argNodes.size());
+        for (auto a : argNodes) {
+            auto arg = eval(a);
+            if (unwinding()) {
+                return {};
+            }
+            // arguments take the types of the parameters, extra ones are promoted as in C
+            if (args.size() < params.size()) {
+                auto converted = convert(arg, typeOf(ast_.op(params[args.size()])));
+                if (!converted) {
+                    return fail("bad argument");
+                }
+                arg = *converted;
+            }
+            else if (arg.kind == Value::Int && arg.bits < 32) {
+                arg = Value::ofInt(arg.integer, 32);
+            }
+            else if (arg.kind == Value::Real) {
+                arg = Value::ofReal(arg.real, 64);
+            }
+            args.push_back(arg);
+        }
+        if (callee.integer == Value::Printf) {
+            return callPrintf(args);
+        }
+
+        auto function = static_cast<NodeId>(callee.integer);
+        auto& state = functions_[function];
+        if (state.native == nullptr && !state.tried && state.count >= threshold_) {
+            promote(function, state);
+        }
+        state.count++;
+        auto returnType = typeOf(ast_.op(function));
+        if (state.native != nullptr) {
+            return callNative(state.native, args, returnType);
+        }
+
+        // a frame of its own: the callee's slots are saved and restored
+        auto [first, last] = resolution_.frame(function);
+        auto saved = saved_.size();
+        saved_.insert(saved_.end(), values_.begin() + first, values_.begin() + last);
+        for (size_t i = 0; i < params.size(); i++) {
+            values_[resolution_.binding(params[i])] = args[i];
+        }
+        auto outer = current_;
+        auto outerType = returnType_;
+        current_ = &state;
+        returnType_ = returnType;
+
+        auto result = eval(ast_.third(function));
+        if (unwind_ == Unwind::Return) {
+            unwind_ = Unwind::None;
+            result = returned_;
+        }
+        else if (!unwinding() && returnValue(result, returnType)) {
+            result = returned_;
+        }
+
+        current_ = outer;
+        returnType_ = outerType;
+        std::copy(saved_.begin() + saved, saved_.end(), values_.begin() + first);
+        saved_.resize(saved);
+        return result;
+    }
+
+    void promote(NodeId function, FunctionState& state) {
+        state.tried = true;
+        std::vector<NodeId> callees;
+        std::unordered_set<NodeId> seen{ function };
+        calleesOf(function, seen, callees);
+        state.native = compile_(function, callees);
+        if (state.native != nullptr) {
+            promoted_++;
+        }
+    }
+
+    // the functions `function` calls (through the values their names have
+    // now), those they call first; not those it defines itself
+    void calleesOf(NodeId function, std::unordered_set<NodeId>& seen, std::vector<NodeId>& callees) {
+        std::vector<NodeId> calls;
+        callsIn(ast_.third(function), calls);
+        for (auto call : calls) {
+            auto slot = resolution_.binding(ast_.first(call));
+            if (slot == Resolution::None) {
+                continue;
+            }
+            auto value = values_[slot];
+            if (value.kind != Value::Function || value.integer == Value::Printf) {
+                continue;
+            }
+            auto callee = static_cast<NodeId>(value.integer);
+            if (seen.insert(callee).second && !contains(ast_.third(function), callee)) {
+                calleesOf(callee, seen, callees);
+                callees.push_back(callee);
+            }
+        }
+    }
+
+    // the calls of a named function under `node`
+    void callsIn(NodeId node, std::vector<NodeId>& calls) {
+        forEachChild(node, [&](NodeId child) { callsIn(child, calls); });
+        if (node != FlatAst::None && ast_.kind(node) == NodeKind::Call
+            && ast_.first(node) != FlatAst::None && ast_.kind(ast_.first(node)) == NodeKind::Identifier) {
+            calls.push_back(node);
+        }
+    }
+
+    bool contains(NodeId node, NodeId target) {
+        if (node == target) {
+            return true;
+        }
+        bool found = false;
+        forEachChild(node, [&](NodeId child) { found = found || contains(child, target); });
+        return found;
+    }
+
+    template <typename F>
+    void forEachChild(NodeId node, F f) {
+        if (node == FlatAst::None) {
+            return;
+        }
+        switch (ast_.kind(node)) {
+        case NodeKind::ExpressionStatement:
+        case NodeKind::Return:
+        case NodeKind::Prefix:
+            f(ast_.first(node));
+            break;
+        case NodeKind::Infix:
+        case NodeKind::While:
+            f(ast_.first(node));
+            f(ast_.second(node));
+            break;
+        case NodeKind::Let:
+            f(ast_.second(node));
+            break;
+        case NodeKind::If:
+        case NodeKind::Function:
+            if (ast_.kind(node) == NodeKind::If) {
+                f(ast_.first(node));
+                f(ast_.second(node));
+            }
+            f(ast_.third(node));
+            break;
+        case NodeKind::Call:
+            f(ast_.first(node));
+            for (auto arg : ast_.list(ast_.second(node))) {
+                f(arg);
+            }
+            break;
+        case NodeKind::Array:
+        case NodeKind::Block:
+            // like the Resolver, stop at a return: what follows is never run
+            // and its names are not resolved
+            for (auto item : ast_.list(ast_.first(node))) {
+                f(item);
+                if (item != FlatAst::None && ast_.kind(item) == NodeKind::Return) {
+                    break;
+                }
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    Value callNative(Native native, const std::vector<Value>& args, const Value& returnType) {
+        std::vector<uint64_t> cells(std::max<size_t>(args.size(), 1));
+        for (size_t i = 0; i < args.size(); i++) {
+            auto& arg = args[i];
+            if (arg.kind == Value::Real && arg.bits == 32) {
+                auto real = static_cast<float>(arg.real);
+                std::memcpy(&cells[i], &real, sizeof(real));
+            }
+            else if (arg.kind == Value::Real) {
+                std::memcpy(&cells[i], &arg.real, sizeof(arg.real));
+            }
+            else {
+                cells[i] = static_cast<uint64_t>(arg.integer);
+            }
+        }
+        native(cells.data());
+        if (returnType.kind == Value::Real && returnType.bits == 32) {
+            float real;
+            std::memcpy(&real, &cells[0], sizeof(real));
+            return Value::ofReal(real, 32);
+        }
+        if (returnType.kind == Value::Real) {
+            double real;
+            std::memcpy(&real, &cells[0], sizeof(real));
+            return Value::ofReal(real, 64);
+        }
+        if (returnType.kind == Value::Int) {
+            // only the low bytes were written
+            uint64_t cell = 0;
+            std::memcpy(&cell, &cells[0], (returnType.bits + 7) / 8);
+            return Value::ofInt(static_cast<int64_t>(cell), returnType.bits);
+        }
+        return { Value::Void };
+    }
+
+    // printf, one conversion at a time, each getting what the generated call passes
+    Value callPrintf(const std::vector<Value>& args) {
+        if (args.empty() || args[0].kind != Value::String) {
+            return fail("printf needs a format string");
+        }
+        int written = 0;
+        size_t next = 1;
+        std::string spec;
+        for (const char* p = args[0].string; *p != '\0'; p++) {
+            if (*p != '%') {
+                std::putchar(*p);
+                written++;
+                continue;
+            }
+            auto end = p + 1;
+            while (*end != '\0' && std::strchr("diouxXeEfFgGaAcsp%", *end) == nullptr) {
+                end++;
+            }
+            if (*end == '%') {
+                // %% prints one %, as the C library does for native code
+                std::putchar('%');
+                written++;
+                p = end;
+                continue;
+            }
+            if (*end == '\0' || next >= args.size()) {
+                auto length = *end == '\0' ? end - p : end - p + 1;
+                written += std::printf("%.*s", static_cast<int>(length), p);
+                if (*end == '\0') {
+                    break;
+                }
+                p = end;
+                continue;
+            }
+            spec.assign(p, end + 1);
+            auto& arg = args[next++];
+            if (arg.kind == Value::Real) {
+                written += std::printf(spec.c_str(), arg.real);
+            }
+            else if (arg.kind == Value::String) {
+                written += std::printf(spec.c_str(), arg.string);
+            }
+            else if (arg.bits == 64) {
+                written += std::printf(spec.c_str(), static_cast<long long>(arg.integer));
+            }
+            else {
+                written += std::printf(spec.c_str(), static_cast<int>(arg.integer));
+            }
+            p = end;
+        }
+        return Value::ofInt(written, 32);
+    }
+
+    const FlatAst& ast_;
+    const Resolution& resolution_;
+    Compile compile_;
+    uint32_t threshold_;
+
+    std::vector<Value> values_; // by slot
+    std::vector<Value> saved_; // the slots of the frames of the calls in progress
+    std::unordered_map<uint32_t, std::string> strings_; // by text, null terminated
+    std::unordered_map<NodeId, FunctionState> functions_;
+    FunctionState* current_ = nullptr; // the function running, null at the top level
+    Value returnType_;
+
+    Unwind unwind_ = Unwind::None;
+    Value returned_;
+    std::vector<std::string> errors_;
+    size_t promoted_ = 0;
+};
+
+#endif
@@ -0,0 +1,81 @@
+#pragma once
+#ifndef LineIndex_h
+#define LineIndex_h
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+/**
+ * LineIndex: maps source byte offsets to 1-based line and column.
+ *
+ * Nothing is counted while lexing. The offsets of all newlines are found
+ * with memchr on the first query and every query is a binary search, so
+ * compiles that never report a location never pay for line tracking.
+ * Newlines inside string literals count like any other.
+ */
+class LineIndex {
+public:
+    /**
+     * Incremental index, fed chunk by chunk with append() (streams, where
+     * the text is gone by the time a location is asked for).
+     */
+    LineIndex() = default;
+
+    /**
+     * Lazy index over text that outlives it.
+     */
+    explicit LineIndex(std::string_view text) : text_(text) {}
+
+    LineIndex(const LineIndex&) = delete;
+    LineIndex& operator=(const LineIndex&) = delete;
+
+    /**
+     * Records the newlines of `chunk`, which starts at source offset `base`.
+     */
+    void append(std::string_view chunk, size_t base) {
+        addNewlines(chunk, base);
+    }
+
+    uint32_t line(size_t offset) const {
+        return static_cast<uint32_t>(lineStart(offset) - lineStarts().begin()) + 1;
+    }
+
+    uint32_t column(size_t offset) const {
+        return static_cast<uint32_t>(offset - *lineStart(offset)) + 1;
+    }
+
+private:
+    const std::vector<uint32_t>& lineStarts() const {
+        // built once, the index may be queried from several threads
+        std::call_once(built_, [this] { addNewlines(text_, 0); });
+        return lineStarts_;
+    }
+
+    // the start of the line containing offset
+    std::vector<uint32_t>::const_iterator lineStart(size_t offset) const {
+        auto& starts = lineStarts();
+        return std::upper_bound(starts.begin(), starts.end(), offset) - 1;
+    }
+
+    void addNewlines(std::string_view text, size_t base) const {
+        const char* begin = text.data();
+        const char* end = begin + text.size();
+        for (const char* p = begin; p < end; p++) {
+            p = static_cast<const char*>(std::memchr(p, '\n', end - p));
+            if (p == nullptr) {
+                break;
+            }
+            lineStarts_.push_back(static_cast<uint32_t>(base + (p - begin) + 1));
+        }
+    }
+
+    std::string_view text_;
+    mutable std::once_flag built_;
+    mutable std::vector<uint32_t> lineStarts_{ 0 };
+};
+
+#endif
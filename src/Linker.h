@@ -0,0 +1,102 @@
+#pragma once
+#ifndef Linker_h
+#define Linker_h
+
+#include <format>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Program.h"
+#include "llvm/TargetParser/Triple.h"
+
+/**
+ * Linker: links object files into an executable with the machine's
+ * ld.lld, or its ld: both take the same arguments.
+ *
+ * Executables are position independent ELF programs for Linux on the
+ * GNU C library; the C runtime (Scrt1.o, crti.o, crtn.o and libc itself)
+ * is taken from the machine's library directories for the target's
+ * architecture.
+ */
+class Linker {
+public:
+    explicit Linker(const llvm::Triple& triple) : triple_(triple) {}
+
+    bool link(std::span<const std::string> objects, const std::string& output) {
+        errors_.clear();
+        if (!triple_.isOSLinux() || !triple_.isOSBinFormatELF()) {
+            errors_.push_back(std::format("cannot link executables for {}", triple_.str()));
+            return false;
+        }
+        auto libraries = libraryDirectory();
+        auto loader = dynamicLinker();
+        if (libraries.empty() || loader.empty()) {
+            errors_.push_back(std::format("no C library for {} on this machine", triple_.str()));
+            return false;
+        }
+        std::vector<std::string> args = {
+            "ld.lld", "-pie", "--eh-frame-hdr", "-dynamic-linker", loader, "-o", output,
+            libraries + "/Scrt1.o", libraries + "/crti.o",
+        };
+        args.insert(args.end(), objects.begin(), objects.end());
+        args.insert(args.end(), { "-L" + libraries, "-lc", libraries + "/crtn.o" });
+        return run(args);
+    }
+
+    /**
+     * What made the last link() fail.
+     */
+    const std::vector<std::string>& errors() const { return errors_; }
+
+private:
+    bool run(const std::vector<std::string>& args) {
+        auto linker = llvm::sys::findProgramByName("ld.lld");
+        if (!linker) {
+            linker = llvm::sys::findProgramByName("ld");
+        }
+        if (!linker) {
+            errors_.push_back("there is no ld.lld or ld to run");
+            return false;
+        }
+        std::vector<llvm::StringRef> argv(args.begin(), args.end());
+        argv[0] = *linker;
+        std::string message;
+        auto status = llvm::sys::ExecuteAndWait(*linker, argv, std::nullopt, {}, 0, 0, &message);
+        if (status != 0) {
+            errors_.push_back(message.empty() ? std::format("{} failed", *linker) : message);
+        }
+        return status == 0;
+    }
+
+    // where the C runtime of the target's architecture is, or empty
+    std::string libraryDirectory() const {
+        auto multiarch = "/usr/lib/" + triple_.getArchName().str() + "-linux-gnu";
+        for (auto dir : { multiarch, std::string("/usr/lib64"), std::string("/usr/lib") }) {
+            if (llvm::sys::fs::exists(dir + "/Scrt1.o")) {
+                return dir;
+            }
+        }
+        return {};
+    }
+
+    std::string dynamicLinker() const {
+        switch (triple_.getArch()) {
+        case llvm::Triple::x86_64:
+            return "/lib64/ld-linux-x86-64.so.2";
+        case llvm::Triple::aarch64:
+            return "/lib/ld-linux-aarch64.so.1";
+        case llvm::Triple::riscv64:
+            return "/lib/ld-linux-riscv64-lp64d.so.1";
+        default:
+            return {};
+        }
+    }
+
+    llvm::Triple triple_;
+    std::vector<std::string> errors_;
+};
+
+#endif
@@ -0,0 +1,42 @@
+#pragma once
+#ifndef Parallel_h
+#define Parallel_h
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+/**
+ * Threads to use when 0 (one per core) is asked for.
+ */
+inline unsigned resolveThreads(unsigned threads) {
+    return threads != 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+}
+
+/**
+ * Calls f(worker, i) for every i in [0, count) on `threads` threads (the
+ * calling thread is worker 0). Items are handed out one at a time, so
+ * uneven items balance out; f must not throw.
+ */
+template <typename F>
+void parallelFor(size_t count, unsigned threads, F f) {
+    threads = static_cast<unsigned>(std::min<size_t>(std::max(1u, threads), count));
+    std::atomic<size_t> next{ 0 };
+    auto work = [&](unsigned worker) {
+        for (size_t i = next++; i < count; i = next++) {
+            f(worker, i);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (unsigned w = 1; w < threads; w++) {
+        workers.emplace_back(work, w);
+    }
+    work(0);
+    for (auto& w : workers) {
+        w.join();
+    }
+}
+
+#endif
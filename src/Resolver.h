@@ -0,0 +1,182 @@
+#pragma once
+#ifndef Resolver_h
+#define Resolver_h
+
+#include <cstdint>
+#include <format>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "Environment.h"
+#include "FlatAst.h"
+#include "Symbols.h"
+
+/**
+ * Resolution: what every name of a FlatAst refers to.
+ *
+ * Each declaration (a predefined global, let, parameter or function) gets
+ * a slot of its own, numbered from 0, so codegen keeps the value of each
+ * in a flat array. binding(node) is the slot an Identifier reads, a Let
+ * defines or, for mut, assigns, a parameter or a Function defines, and
+ * None for anything else.
+ */
+class Resolution {
+public:
+    static constexpr uint32_t None = Environment::None;
+
+    uint32_t binding(NodeId node) const { return bindings_[node]; }
+    uint32_t slots() const { return slots_; }
+
+    /**
+     * The slots [first, last) of the parameters and locals of the function
+     * defined at `node`, those of its nested functions included: what each
+     * call of it binds.
+     */
+    std::pair<uint32_t, uint32_t> frame(NodeId node) const { return frames_.at(node); }
+
+    /**
+     * Every name used where it is not defined, in program order.
+     */
+    const std::vector<std::string>& errors() const { return errors_; }
+
+private:
+    friend class Resolver;
+
+    std::vector<uint32_t> bindings_;
+    uint32_t slots_ = 0;
+    std::unordered_map<NodeId, std::pair<uint32_t, uint32_t>> frames_;
+    std::vector<std::string> errors_;
+};
+
+/**
+ * Resolver: binds the names of a program to slots, ahead of codegen.
+ *
+ * It walks the program as codegen does and follows its scoping: blocks
+ * and function parameters open scopes, a let binds its name after its
+ * value is evaluated, a function binds its name before its parameters and
+ * body, unless the module already has a function by that name, and the
+ * statements of a block after a return are never compiled. Index and hash
+ * expressions are not compiled either, so their names are not resolved.
+ */
+class Resolver {
+public:
+    explicit Resolver(const FlatAst& ast) : ast_(ast) {
+        result_.bindings_.assign(ast.size(), Resolution::None);
+    }
+
+    /**
+     * Binds a name the runtime defines before the program in the outermost
+     * scope; returns its slot.
+     */
+    uint32_t predefine(Symbol name) { return env_.define(name, result_.slots_++); }
+
+    /**
+     * Records a function the module has before the program: functions
+     * defined later by that name do not bind it.
+     */
+    void external(Symbol name) { functions_.insert(name); }
+
+    Resolution run() && {
+        for (auto stmt : ast_.roots()) {
+            resolve(stmt);
+        }
+        return std::move(result_);
+    }
+
+private:
+    void resolve(NodeId node) {
+        if (node == FlatAst::None) {
+            return;
+        }
+        switch (ast_.kind(node)) {
+        case NodeKind::ExpressionStatement:
+        case NodeKind::Return:
+        case NodeKind::Prefix:
+            resolve(ast_.first(node));
+            break;
+        case NodeKind::Infix:
+        case NodeKind::While:
+            resolve(ast_.first(node));
+            resolve(ast_.second(node));
+            break;
+        case NodeKind::If:
+            resolve(ast_.first(node));
+            resolve(ast_.second(node));
+            resolve(ast_.third(node));
+            break;
+        case NodeKind::Call:
+            resolve(ast_.first(node));
+            resolveList(ast_.second(node));
+            break;
+        case NodeKind::Array:
+            resolveList(ast_.first(node));
+            break;
+        case NodeKind::Block: {
+            Environment::Scope scope(env_);
+            for (auto stmt : ast_.list(ast_.first(node))) {
+                resolve(stmt);
+                if (stmt != FlatAst::None && ast_.kind(stmt) == NodeKind::Return) {
+                    break;
+                }
+            }
+            break;
+        }
+        case NodeKind::Let:
+            resolve(ast_.second(node));
+            if (ast_.op(node) == MUT) {
+                use(node);
+            }
+            else {
+                define(node);
+            }
+            break;
+        case NodeKind::Function: {
+            if (functions_.insert(ast_.symbol(ast_.first(node))).second) {
+                define(node);
+            }
+            Environment::Scope scope(env_); // the parameters
+            auto first = result_.slots_;
+            for (auto param : ast_.list(ast_.second(node))) {
+                define(param);
+            }
+            resolve(ast_.third(node));
+            result_.frames_[node] = { first, result_.slots_ };
+            break;
+        }
+        case NodeKind::Identifier:
+            use(node);
+            break;
+        default:
+            break;
+        }
+    }
+
+    void resolveList(uint32_t list) {
+        for (auto item : ast_.list(list)) {
+            resolve(item);
+        }
+    }
+
+    // binds the name of `node` to a new slot
+    void define(NodeId node) {
+        result_.bindings_[node] = env_.define(ast_.symbol(ast_.first(node)), result_.slots_++);
+    }
+
+    void use(NodeId node) {
+        auto name = ast_.first(node);
+        result_.bindings_[node] = env_.lookup(ast_.symbol(name));
+        if (result_.bindings_[node] == Resolution::None) {
+            result_.errors_.push_back(std::format("unknown name {}", ast_.name(name)));
+        }
+    }
+
+    const FlatAst& ast_;
+    Environment env_;
+    std::unordered_set<Symbol> functions_; // the module has a function by that name
+    Resolution result_;
+};
+
+#endif
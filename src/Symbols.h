@@ -0,0 +1,135 @@
+#pragma once
+#ifndef Symbols_h
+#define Symbols_h
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * A name, as an index into the SymbolTable. Equal names have equal
+ * symbols, so names are compared and looked up as integers.
+ */
+using Symbol = uint32_t;
+
+/**
+ * SymbolTable: interns names, giving each distinct one a dense Symbol.
+ *
+ * Names are copied in once, so symbols and the views name() returns stay
+ * valid for the life of the table whatever the text they came from.
+ * Interning may run on several threads at once (lexing in parallel); the
+ * table is locked, so hot paths go through a SymbolCache.
+ */
+class SymbolTable {
+public:
+    static constexpr Symbol None = UINT32_MAX;
+
+    /**
+     * The table shared by every program of the process.
+     */
+    static SymbolTable& global() {
+        static SymbolTable table;
+        return table;
+    }
+
+    Symbol intern(std::string_view name) {
+        {
+            std::shared_lock lock(mutex_);
+            if (auto it = symbols_.find(name); it != symbols_.end()) {
+                return it->second;
+            }
+        }
+        std::unique_lock lock(mutex_);
+        if (auto it = symbols_.find(name); it != symbols_.end()) {
+            return it->second;
+        }
+        auto symbol = static_cast<Symbol>(names_.size());
+        // keyed by the table's own copy
+        symbols_.emplace(names_.emplace_back(name), symbol);
+        return symbol;
+    }
+
+    std::string_view name(Symbol symbol) const {
+        std::shared_lock lock(mutex_);
+        return names_[symbol];
+    }
+
+    size_t size() const {
+        std::shared_lock lock(mutex_);
+        return names_.size();
+    }
+
+private:
+    mutable std::shared_mutex mutex_;
+    std::unordered_map<std::string_view, Symbol> symbols_;
+    std::deque<std::string> names_; // deque: growing never moves a name
+};
+
+/**
+ * SymbolCache: the names one thread has interned, looked up without
+ * taking the table's lock. An open addressing table with a cheap hash:
+ * every identifier the lexer meets goes through it.
+ */
+class SymbolCache {
+public:
+    explicit SymbolCache(SymbolTable& table = SymbolTable::global()) : table_(table), slots_(64) {}
+
+    Symbol intern(std::string_view name) {
+        auto hash = hashOf(name);
+        for (size_t i = hash & (slots_.size() - 1);; i = (i + 1) & (slots_.size() - 1)) {
+            auto& slot = slots_[i];
+            if (slot.symbol == SymbolTable::None) {
+                auto symbol = table_.intern(name);
+                slot = { hash, symbol, table_.name(symbol) };
+                if (++used_ * 2 > slots_.size()) {
+                    grow();
+                }
+                return symbol;
+            }
+            if (slot.hash == hash && slot.name == name) {
+                return slot.symbol;
+            }
+        }
+    }
+
+private:
+    struct Slot {
+        uint64_t hash = 0;
+        Symbol symbol = SymbolTable::None;
+        std::string_view name;
+    };
+
+    // FNV-1a
+    static uint64_t hashOf(std::string_view name) {
+        uint64_t hash = 14695981039346656037ull;
+        for (unsigned char c : name) {
+            hash = (hash ^ c) * 1099511628211ull;
+        }
+        return hash ^ (hash >> 32);
+    }
+
+    void grow() {
+        std::vector<Slot> slots(slots_.size() * 2);
+        for (auto& slot : slots_) {
+            if (slot.symbol != SymbolTable::None) {
+                size_t i = slot.hash & (slots.size() - 1);
+                while (slots[i].symbol != SymbolTable::None) {
+                    i = (i + 1) & (slots.size() - 1);
+                }
+                slots[i] = slot;
+            }
+        }
+        slots_ = std::move(slots);
+    }
+
+    SymbolTable& table_;
+    std::vector<Slot> slots_;
+    size_t used_ = 0;
+};
+
+#endif
@@ -0,0 +1,257 @@
+#pragma once
+#ifndef TokenStream_h
+#define TokenStream_h
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../lexer.h"
+#include "LineIndex.h"
+#include "Parallel.h"
+#include "Symbols.h"
+
+/**
+ * TokenStream: the whole program tokenized once.
+ *
+ * Kinds, offsets and lengths live in separate contiguous arrays (struct of
+ * arrays), so the parser gets O(1) random access and lookahead, and a
+ * finished stream is read-only and can be shared between threads. Lines and
+ * columns are resolved from the offsets only when asked for (LineIndex). The last token is always EOF_TOKEN and
+ * reads past the end return it, like the Lexer does.
+ *
+ * Offsets are source byte offsets of the token literal, 32 bits wide:
+ * sources are limited to 4 GiB. Identifiers are interned as they are
+ * lexed: symbol() is their Symbol in the global SymbolTable.
+ */
+class TokenStream {
+public:
+    /**
+     * Tokenizes text held by the caller; literals are views into it, so it
+     * must outlive the stream.
+     */
+    explicit TokenStream(std::string_view input) : text_(input), lines_(input) {
+        Lexer lexer(input);
+        SymbolCache symbols;
+        tokens_.reserve(input.size() / 4);
+        while (tokens_.push(lexer, symbols).Type != EOF_TOKEN) {
+        }
+    }
+
+    /**
+     * Tokenizes large inputs on `threads` threads (0: one per core). The
+     * input is cut at whitespace outside string literals, each piece is
+     * lexed on its own and the pieces are stitched in order; the result is
+     * the same as the single threaded constructor's.
+     */
+    TokenStream(std::string_view input, unsigned threads) : text_(input), lines_(input) {
+        threads = resolveThreads(threads);
+        auto splits = splitPoints(input, threads);
+        std::vector<Tokens> pieces(splits.size() - 1);
+        parallelFor(pieces.size(), threads, [&](unsigned, size_t k) {
+            Lexer lexer(input.substr(splits[k], splits[k + 1] - splits[k]));
+            SymbolCache symbols;
+            pieces[k].reserve((splits[k + 1] - splits[k]) / 4);
+            while (pieces[k].push(lexer, symbols, splits[k]).Type != EOF_TOKEN) {
+            }
+            // only the last piece ends the program
+            if (k + 1 < pieces.size()) {
+                pieces[k].pop();
+            }
+        });
+
+        std::vector<size_t> starts{ 0 };
+        for (auto& piece : pieces) {
+            starts.push_back(starts.back() + piece.kinds.size());
+        }
+        tokens_.resize(starts.back());
+        parallelFor(pieces.size(), threads, [&](unsigned, size_t k) {
+            tokens_.assign(starts[k], pieces[k]);
+            pieces[k] = {};
+        });
+    }
+
+    /**
+     * Tokenizes a stream read in chunks. Only the token text is kept, in a
+     * pool owned by the stream, never the whole source.
+     */
+    explicit TokenStream(std::istream& stream) {
+        Lexer lexer(stream, &lines_);
+        SymbolCache symbols;
+        Token tok;
+        do {
+            tok = tokens_.push(lexer, symbols);
+            textOffsets_.push_back(static_cast<uint32_t>(pool_.size()));
+            pool_.append(tok.Literal);
+        } while (tok.Type != EOF_TOKEN);
+        text_ = pool_;
+    }
+
+    /**
+     * Tokenizes text the stream takes over, for text that has no other
+     * owner (an edited region being reparsed).
+     */
+    explicit TokenStream(std::string&& text) : pool_(std::move(text)), lines_(pool_) {
+        text_ = pool_;
+        Lexer lexer(text_);
+        SymbolCache symbols;
+        tokens_.reserve(text_.size() / 4);
+        while (tokens_.push(lexer, symbols).Type != EOF_TOKEN) {
+        }
+    }
+
+    TokenStream(const TokenStream&) = delete;
+    TokenStream& operator=(const TokenStream&) = delete;
+
+    // pieces smaller than this are not worth a thread
+    static constexpr size_t MinParallelChunk = 1 << 20;
+
+    size_t size() const { return tokens_.kinds.size(); }
+
+    TokenType kind(size_t i) const { return tokens_.kinds[clamp(i)]; }
+    uint32_t offset(size_t i) const { return tokens_.offsets[clamp(i)]; }
+    uint32_t length(size_t i) const { return tokens_.lengths[clamp(i)]; }
+    // SymbolTable::None for anything but an IDENT
+    Symbol symbol(size_t i) const { return tokens_.symbols[clamp(i)]; }
+    // where token i begins: a string literal's opening quote is not part of it
+    uint32_t start(size_t i) const { return offset(i) - (kind(i) == STRING ? 1 : 0); }
+    uint32_t line(size_t i) const { return lines_.line(offset(i)); }
+    uint32_t column(size_t i) const { return lines_.column(offset(i)); }
+
+    std::string_view text(size_t i) const {
+        i = clamp(i);
+        uint32_t start = textOffsets_.empty() ? tokens_.offsets[i] : textOffsets_[i];
+        return text_.substr(start, tokens_.lengths[i]);
+    }
+
+    Token token(size_t i) const { return Token{ kind(i), text(i) }; }
+
+    /**
+     * The whole source, when the stream views or holds it; streams read in
+     * chunks keep only the token text and return an empty view.
+     */
+    std::string_view source() const { return textOffsets_.empty() ? text_ : std::string_view(); }
+
+private:
+    /**
+     * The token arrays, also used for the pieces of a parallel tokenize.
+     */
+    struct Tokens {
+        std::vector<TokenType> kinds;
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> lengths;
+        std::vector<Symbol> symbols;
+
+        void reserve(size_t n) {
+            kinds.reserve(n);
+            offsets.reserve(n);
+            lengths.reserve(n);
+            symbols.reserve(n);
+        }
+
+        void resize(size_t n) {
+            kinds.resize(n);
+            offsets.resize(n);
+            lengths.resize(n);
+            symbols.resize(n);
+        }
+
+        /**
+         * Appends the next token of the lexer and returns it; `base` is the
+         * source offset of the lexer input.
+         */
+        Token push(Lexer& lexer, SymbolCache& names, size_t base = 0) {
+            Token tok = lexer.NextToken();
+            kinds.push_back(tok.Type);
+            offsets.push_back(static_cast<uint32_t>(base + lexer.GetTokenOffset()));
+            lengths.push_back(static_cast<uint32_t>(tok.Literal.size()));
+            symbols.push_back(tok.Type == IDENT ? names.intern(tok.Literal) : SymbolTable::None);
+            return tok;
+        }
+
+        void pop() {
+            kinds.pop_back();
+            offsets.pop_back();
+            lengths.pop_back();
+            symbols.pop_back();
+        }
+
+        // overwrites the tokens from index `at` on with `piece`
+        void assign(size_t at, const Tokens& piece) {
+            std::copy(piece.kinds.begin(), piece.kinds.end(), kinds.begin() + at);
+            std::copy(piece.offsets.begin(), piece.offsets.end(), offsets.begin() + at);
+            std::copy(piece.lengths.begin(), piece.lengths.end(), lengths.begin() + at);
+            std::copy(piece.symbols.begin(), piece.symbols.end(), symbols.begin() + at);
+        }
+    };
+
+    size_t clamp(size_t i) const { return std::min(i, tokens_.kinds.size() - 1); }
+
+    /**
+     * Where the input can be cut: 0, the restart points, input.size().
+     *
+     * Strings end at the next '"', so a position is outside a string iff
+     * an even number of '"' precede it; the quotes of each part are counted
+     * in parallel. From each part boundary the cut moves on to the first
+     * whitespace outside a string, which always separates two tokens.
+     * A NUL byte ends the program (or a string) in the Lexer, inputs that
+     * contain one are lexed in a single piece.
+     */
+    static std::vector<size_t> splitPoints(std::string_view input, unsigned threads) {
+        size_t parts = std::min<size_t>(threads, input.size() / MinParallelChunk);
+        if (parts <= 1) {
+            return { 0, input.size() };
+        }
+        size_t step = input.size() / parts;
+        std::vector<size_t> quotes(parts);
+        std::vector<char> hasNul(parts);
+        parallelFor(parts, threads, [&](unsigned, size_t k) {
+            auto part = input.substr(k * step, k + 1 == parts ? std::string_view::npos : step);
+            quotes[k] = std::count(part.begin(), part.end(), '"');
+            hasNul[k] = std::memchr(part.data(), 0, part.size()) != nullptr;
+        });
+        if (std::count(hasNul.begin(), hasNul.end(), 1) != 0) {
+            return { 0, input.size() };
+        }
+
+        std::vector<size_t> splits{ 0 };
+        size_t quotesBefore = 0;
+        for (size_t k = 1; k < parts; k++) {
+            quotesBefore += quotes[k - 1];
+            bool inString = quotesBefore % 2 != 0;
+            size_t p = k * step;
+            while (p < input.size() && (inString || !hasCharClass(input[p], CC_SPACE))) {
+                if (input[p] == '"') {
+                    inString = !inString;
+                }
+                p++;
+            }
+            if (p >= input.size()) {
+                break;
+            }
+            if (p > splits.back()) {
+                splits.push_back(p);
+            }
+        }
+        splits.push_back(input.size());
+        return splits;
+    }
+
+    Tokens tokens_;
+
+    /**
+     * Text the literals are sliced from: the caller's input, pool_ holding
+     * text the stream took over, or pool_ indexed by textOffsets_ for
+     * streams.
+     */
+    std::string_view text_;
+    std::string pool_;
+    std::vector<uint32_t> textOffsets_;
+    LineIndex lines_;
+};
+
+#endif
@@ -0,0 +1,178 @@
+#pragma once
+#ifndef TopLevels_h
+#define TopLevels_h
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+struct Statement;
+struct ProgramPiece;
+
+/**
+ * One step of the top-level parse loop: the statement built (null on a
+ * parse error) from tokens [first, last] of its piece, having looked at
+ * the tokens up to peek.
+ *
+ * Its slot, the statement text and the blanks after it, starts at program
+ * offset `start` and piece text offset `textStart`. The first slot starts
+ * at 0, the last one holds only the EOF token and runs to the end of the
+ * program.
+ */
+struct TopLevel {
+    Statement* statement = nullptr;
+    const ProgramPiece* piece = nullptr;
+    uint32_t first = 0, last = 0, peek = 0;
+    uint32_t start = 0, textStart = 0;
+};
+
+/**
+ * TopLevelList: the top-level steps of a program, in blocks of at most
+ * BlockSize.
+ *
+ * Blocks are immutable once the list is built and are shared by every
+ * version of a program that contains them, so a reparse copies the block
+ * list and the blocks around the edit, never the whole program. Slot
+ * starts in a block are off by the block's shift.
+ */
+class TopLevelList {
+public:
+    static constexpr size_t BlockSize = 512;
+
+    class iterator {
+    public:
+        iterator(const TopLevelList* list, size_t block, size_t i) : list_(list), block_(block), i_(i) {}
+
+        TopLevel operator*() const { return list_->at(block_, i_); }
+
+        iterator& operator++() {
+            if (++i_ == list_->blocks_[block_].units->size()) {
+                block_++;
+                i_ = 0;
+            }
+            return *this;
+        }
+
+        bool operator!=(const iterator& other) const { return block_ != other.block_ || i_ != other.i_; }
+
+    private:
+        const TopLevelList* list_;
+        size_t block_;
+        size_t i_;
+    };
+
+    size_t size() const { return ends_.empty() ? 0 : ends_.back(); }
+    bool empty() const { return size() == 0; }
+
+    iterator begin() const { return iterator(this, 0, 0); }
+    iterator end() const { return iterator(this, blocks_.size(), 0); }
+
+    TopLevel operator[](size_t k) const {
+        size_t b = blockOf(k);
+        return at(b, k - blockBegin(b));
+    }
+
+    /**
+     * The index of the first step whose slot starts at or after `offset`.
+     */
+    size_t lowerBound(size_t offset) const {
+        size_t low = 0;
+        size_t count = size();
+        while (count > 0) {
+            size_t half = count / 2;
+            if ((*this)[low + half].start < offset) {
+                low += half + 1;
+                count -= half + 1;
+            }
+            else {
+                count = half;
+            }
+        }
+        return low;
+    }
+
+    /**
+     * Appends a step while the list is being built.
+     */
+    void push_back(const TopLevel& unit) {
+        if (blocks_.empty() || blocks_.back().units->size() == BlockSize || blocks_.back().units.use_count() > 1) {
+            blocks_.push_back(Block{ std::make_shared<std::vector<TopLevel>>() });
+            blocks_.back().units->reserve(BlockSize);
+            ends_.push_back(size());
+        }
+        blocks_.back().units->push_back(unit);
+        ends_.back()++;
+    }
+
+    /**
+     * A copy of the list with steps [from, to) replaced by `units` and the
+     * slots from `to` on moved by `shift` bytes. The blocks before and
+     * after the edit are shared with this list; the steps left over in
+     * the blocks at both ends are copied into new ones with `units`,
+     * taking in following blocks while that run is short, so blocks do
+     * not get ever smaller.
+     */
+    TopLevelList replace(size_t from, size_t to, const std::vector<TopLevel>& units, int64_t shift) const {
+        TopLevelList out;
+        size_t first = blockOf(from);
+        for (size_t b = 0; b < first; b++) {
+            out.append(blocks_[b]);
+        }
+
+        std::vector<TopLevel> run;
+        for (size_t k = blockBegin(first); k < from; k++) {
+            run.push_back((*this)[k]);
+        }
+        run.insert(run.end(), units.begin(), units.end());
+        size_t next = to < size() ? blockOf(to) : blocks_.size();
+        if (next < blocks_.size()) {
+            for (size_t i = to - blockBegin(next); i < blocks_[next].units->size(); i++) {
+                run.push_back(moved(at(next, i), shift));
+            }
+            next++;
+        }
+        while (run.size() < BlockSize / 2 && next < blocks_.size()) {
+            for (size_t i = 0; i < blocks_[next].units->size(); i++) {
+                run.push_back(moved(at(next, i), shift));
+            }
+            next++;
+        }
+        for (size_t k = 0; k < run.size(); k += BlockSize) {
+            auto end = run.begin() + std::min(k + BlockSize, run.size());
+            out.append(Block{ std::make_shared<std::vector<TopLevel>>(run.begin() + k, end) });
+        }
+
+        for (size_t b = next; b < blocks_.size(); b++) {
+            out.append(Block{ blocks_[b].units, blocks_[b].shift + shift });
+        }
+        return out;
+    }
+
+private:
+    struct Block {
+        std::shared_ptr<std::vector<TopLevel>> units;
+        int64_t shift = 0;
+    };
+
+    static TopLevel moved(TopLevel unit, int64_t shift) {
+        unit.start = static_cast<uint32_t>(unit.start + shift);
+        return unit;
+    }
+
+    TopLevel at(size_t block, size_t i) const { return moved((*blocks_[block].units)[i], blocks_[block].shift); }
+
+    size_t blockOf(size_t k) const { return std::upper_bound(ends_.begin(), ends_.end(), k) - ends_.begin(); }
+    size_t blockBegin(size_t b) const { return b == 0 ? 0 : ends_[b - 1]; }
+
+    void append(const Block& block) {
+        blocks_.push_back(block);
+        ends_.push_back(size() + block.units->size());
+    }
+
+    std::vector<Block> blocks_;
+    std::vector<size_t> ends_; // steps up to the end of each block
+};
+
+#endif
@@ -0,0 +1,23 @@
+# Runs PROGRAM with cminus (CMINUS) on the JIT, --run, and on the tiered
+# engine, --interpret --hot-threshold=THRESHOLD, and fails unless both
+# print the same and exit with the same status. When PROGRAM has a .out
+# file beside it (foo.out for foo.cm), what they print must also be what
+# that file holds.
+execute_process(COMMAND ${CMINUS} --run ${PROGRAM}
+  OUTPUT_VARIABLE expected ERROR_VARIABLE expectedErrors RESULT_VARIABLE expectedStatus)
+execute_process(COMMAND ${CMINUS} --interpret --hot-threshold=${THRESHOLD} ${PROGRAM}
+  OUTPUT_VARIABLE actual ERROR_VARIABLE actualErrors RESULT_VARIABLE actualStatus)
+if(NOT expectedStatus STREQUAL actualStatus)
+  message(FATAL_ERROR "--run exited with ${expectedStatus} ${expectedErrors}\n"
+    "--interpret exited with ${actualStatus} ${actualErrors}")
+endif()
+if(NOT expected STREQUAL actual)
+  message(FATAL_ERROR "--run printed\n${expected}\n--interpret printed\n${actual}")
+endif()
+string(REGEX REPLACE "\\.cm$" ".out" recordedFile ${PROGRAM})
+if(EXISTS ${recordedFile})
+  file(READ ${recordedFile} recorded)
+  if(NOT expected STREQUAL recorded)
+    message(FATAL_ERROR "--run printed\n${expected}\n${recordedFile} holds\n${recorded}")
+  endif()
+endif()